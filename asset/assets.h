@@ -5,14 +5,35 @@
 #include "sprites.h"   // Sprites
 #include "hud.h"       // HUDs like pistol sprite
 
-
-// Here is textures table (to-do)
-
-
-// Here is sprites table (to-do)
-
-
-// Here is HUD table (to-do)
-
+// Asset ids - index into the asset tables below
+enum {
+    // Textures
+    ASSET_GROUND, ASSET_CEILING, ASSET_GREYSTONE, ASSET_MOSSY, ASSET_COLORSTONE,
+    // Sprites
+    ASSET_HANGMAN, ASSET_BARREL, ASSET_ARMOR_SUIT, ASSET_BED, ASSET_PLANT, ASSET_SINK, ASSET_DEAD_PLANT, ASSET_LIGHT,
+    // HUD
+    ASSET_PISTOL, ASSET_HUD,
+    ASSET_COUNT
+};
+
+// Asset description (name matches the source .ppm file name and the array name)
+typedef struct {
+    const char *name;  // Asset name
+    int width;         // Image width in pixels
+    int height;        // Image height in pixels
+} AssetInfo;
+
+// Here is textures, sprites and HUD table
+static const AssetInfo asset_info[ASSET_COUNT] = {
+    { "ground", 64, 64 },     { "ceiling", 64, 64 },    { "greystone", 64, 64 },
+    { "mossy", 64, 64 },      { "colorstone", 64, 64 },
+    { "hangman", 64, 64 },    { "barrel", 64, 64 },     { "armor_suit", 64, 64 },
+    { "bed", 64, 64 },        { "plant", 64, 64 },      { "sink", 64, 64 },
+    { "dead_plant", 64, 64 }, { "light", 64, 64 },
+    { "pistol", 122, 131 },   { "hud", 142, 38 },
+};
+
+// Pixel data used by the engine, defined in raycast.c. Entries start with the compiled-in arrays and can be swapped at runtime (asset hot-reload)
+extern const uint32_t *asset_pixels[ASSET_COUNT];
 
 #endif
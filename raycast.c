@@ -10,6 +10,11 @@
 #define SDL_MAIN_HANDLED
 #endif
 
+// Linux specific macro for memfd_create() used by render service
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 // Platform-specific SDL includes
 #ifdef __APPLE__
     #include <SDL.h>                                                    // macOS SDL header location
@@ -24,6 +29,26 @@
 #include <stdint.h>                                                     // Fixed-width integer types
 #include <math.h>                                                       // Mathematical functions
 #include <string.h>                                                     // String manipulation functions
+#include <ctype.h>                                                      // Character classification (.ppm parsing)
+#include <stdarg.h>                                                     // Variable arguments (metrics page formatting)
+#include <signal.h>                                                     // sig_atomic_t, clean service shutdown on Ctrl+C
+
+// SSE2 intrinsics for video capture color conversion (x86-64 always has SSE2)
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+// Linux specific includes for asset hot-reload (inotify) and render service (sockets, shared memory)
+#ifdef __linux__
+    #include <sys/inotify.h>                                            // File system change notifications
+    #include <poll.h>                                                   // Waiting on inotify descriptor with timeout
+    #include <unistd.h>                                                 // read() and close()
+    #include <sys/socket.h>                                             // Unix domain sockets
+    #include <sys/un.h>                                                 // Unix socket address
+    #include <sys/mman.h>                                               // Shared memory frame ring
+    #include <netinet/in.h>                                             // Loopback TCP address of metrics endpoint
+    #include <arpa/inet.h>                                              // htonl() / htons()
+#endif
 
 // Custom assets
 #include "asset/assets.h"                                               // Textures and sprites
@@ -48,13 +73,91 @@
 #define CEILING_MIN_BRIGHTNESS 0.65f                                    // Minimum ceiling brightness at far distances  
 #define SPRITE_MIN_BRIGHTNESS 0.7f                                      // Minimum sprite brightness at far distances
 
+// Draw distance and fog configuration
+#define FOG_COLOR 0x2C2E33                                              // Colour of fully fogged surfaces
+#define FOG_START 0.5f                                                  // Fog starts at this fraction of view distance
+#define FOG_LEVELS 16                                                   // Fog shade table entries (level is stored in surface records)
+
+// Asset hot-reload configuration
+#define ASSET_SOURCE_DIR "asset/src"                                    // Directory with .ppm asset sources watched for changes (relative to working directory)
+
+// Video capture configuration
+#define CAPTURE_RING_SIZE 8                                             // Preallocated frames between game loop and writer thread
+#define CAPTURE_FPS 100                                                 // Frame rate stored in Y4M header (game loop rate)
+#define CAPTURE_IO_BUFFER (8 * 1024 * 1024)                             // Output buffer size for large sequential writes
+
+// Worker pool and batch rendering configuration
+#define MAX_WORKERS 32                                                  // Upper limit of worker threads
+#define MAX_FRAME_STAGES 8                                              // Upper limit of stages in frame job graph
+#define BATCH_BUFFERS_PER_WORKER 2                                      // Framebuffers per worker, so rendering overlaps image writing
+
+// Render service configuration
+#define SERVICE_RING_SLOTS 8                                            // Frames in shared memory ring of every client (max batch size)
+#define SERVICE_MAX_CLIENTS 16                                          // Maximum number of connected clients
+#define SERVICE_SLOT_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT * 8)            // Bytes per ring slot (frame + object ids)
+
+// Metrics endpoint configuration
+#define METRICS_DRAIN_MS 100                                            // How often metrics thread moves counters to 64-bit totals
+#define METRICS_FRAME_BUCKETS 8                                         // Number of frame time histogram buckets (+Inf is extra)
+
+// Engine state snapshot configuration
+#define SNAPSHOT_MAGIC 0x50414E53                                       // "SNAP" - snapshot file signature
+#define SNAPSHOT_VERSION 4                                              // Bump when Snapshot layout changes
+#define SNAPSHOT_FILE "quicksave.snap"                                  // Quicksave file (F5 save, F8 load)
+
+// Simulation configuration
+#define SIM_TICK_RATE 60                                                // Simulation ticks per second (independent of frame rate)
+#define PLAYER_MOVE_SPEED 250.0f                                        // Player walking speed in world units per second
+#define PLAYER_TURN_SPEED 180.0f                                        // Player turning speed in degrees per second
+#define SECURITY_CAM_SWEEP 25.0f                                        // Security camera pans this many degrees to each side
+#define SECURITY_CAM_PERIOD 8                                           // Seconds per security camera pan cycle
+
+// Particle configuration
+#define MAX_PARTICLES 4096                                              // Live particles (multiple of 4, spawns beyond are dropped)
+#define PARTICLE_DRAW_BUDGET 2048                                       // Particles drawn per view and frame (rest is skipped)
+#define PARTICLE_GRAVITY 300.0f                                         // Downward acceleration in world units per second squared
+#define PARTICLE_SIZE 1.5f                                              // Billboard size in world units
+#define PARTICLE_MAX_PIXELS 6                                           // Largest billboard on screen in pixels
+#define IMPACT_SPARKS 96                                                // Sparks per bullet impact
+#define IMPACT_SMOKE 32                                                 // Smoke puffs per bullet impact
+
+// Wall decal configuration
+#define DECALS_PER_FACE 4                                               // Decals kept on one wall face (least recently used is evicted)
+#define DECAL_ATLAS_SIZE 64                                             // Decal atlas width and height in texels
+
+// Debug view configuration
+#define DEBUG_STRIP_RAYS 16                                             // Rays per strip timed in strip time heatmap
+
+// Heightmap terrain settings
+#define TERRAIN_SIZE 1024                                               // Heightmap width and height in texels (power of 2, terrain wraps around)
+#define TERRAIN_HEIGHT_SCALE 0.6f                                       // World units per height step (heights are 0-255)
+#define TERRAIN_WATER_LEVEL 80                                          // Heights below this are flat water
+#define TERRAIN_EYE_HEIGHT 40.0f                                        // Camera height above ground
+#define TERRAIN_DRAW_DISTANCE 1200.0f                                   // Farthest sampled terrain point
+#define TERRAIN_LOD_GROWTH 0.012f                                       // Sample step grows with distance (level of detail)
+#define TERRAIN_DISTANCE_DIMMING 22.0f                                  // How quickly terrain gets dark with distance
+#define TERRAIN_MIN_BRIGHTNESS 0.45f                                    // Minimum terrain brightness at far distances
+
 // Map configuration constants
 #define MAPX 8                                                          // Map width in cells
 #define MAPY 8                                                          // Map height in cells  
 #define MAP_CELL_SIZE 64                                                // Size of each map cell in pixels
+#define MAX_WALL_HEIGHT 2.0f                                            // Tallest wall in map_heights (rays stop once nothing taller can be seen)
+#define MAX_COLUMN_OCCLUDERS 16                                         // Walls remembered per column for sprite clipping
+#define PLANE_TILE_WIDTH 64                                             // Floor/ceiling tile width in pixels (unit of parallel work)
+#define PLANE_TILE_HEIGHT 16                                            // Floor/ceiling tile height in pixels
+#define SURFACE_RECORD(asset, u, v, light, fog) ((uint32_t)((asset) + 1) << 28 | (uint32_t)(fog) << 24 | (uint32_t)(light) << 12 | (uint32_t)(v) << 6 | (uint32_t)(u)) // Deferred shading record
+_Static_assert(ASSET_COUNT < 16, "surface record asset field is 4 bits");
+#define OBJECT_ID(cls, type, instance) ((uint32_t)(cls) << 28 | (uint32_t)(type) << 20 | (uint32_t)(instance)) // Object id of pixel
+#define OBJECT_NO_INSTANCE 0xFFFFF                                      // Instance of surface outside map (20 bits)
+#define TERRAIN_ID_ROWS 512                                             // Terrain rows per id type value (type holds ty / TERRAIN_ID_ROWS)
+_Static_assert(TERRAIN_ID_ROWS * TERRAIN_SIZE - 1 < OBJECT_NO_INSTANCE, "terrain texel instance collides with OBJECT_NO_INSTANCE");
+_Static_assert(TERRAIN_SIZE / TERRAIN_ID_ROWS <= 256, "terrain id rows don't fit 8-bit type field");
+#define PIP_SIZE 160                                                    // Picture-in-picture (security camera) view size in pixels
+#define PIP_MARGIN 8                                                    // Distance of picture-in-picture view from 3D view corner
 
-// Static map layout (0 = empty space, 1 - stone wall, 2 - mossy stone wall, 3 - color stone wall)
-static const char map[] = {
+// Map layout (0 = empty space, 1 - stone wall, 2 - mossy stone wall, 3 - color stone wall), editable at runtime
+static char map[] = {
     3,3,3,3,3,1,1,1,                  
     3,0,0,0,0,1,0,1,                  
     3,0,0,0,0,0,0,1,                  
@@ -65,8 +168,20 @@ static const char map[] = {
     1,1,1,1,1,1,1,3,                  
 };
 
-// Static sprite layout (0 = no sprite, 1 - hangman, 2 - barrel, 3 - armor_suit, 4 - bed, 5 - plant, 6 - sink, 7 - dead_plant, 8 - light)
-static const char map_sprites[] = {
+// Wall heights in cells (1.0 = standard wall, lower walls can be seen over, taller walls rise above ceiling)
+static const float map_heights[] = {
+    1,1,1,1,1,2,2,2,
+    1,0,0,0,0,1,0,2,
+    1,0,0,0,0,0,0,2,
+    1,0,0,0,0,0,0,1,
+    0.5,0.5,0,0,0,0,0.375,1,
+    1,0,0,0,0,0.375,0.375,1,
+    1,0,0,0,0,0,0,1,
+    1,1,1,1,1,1,1,1,
+};
+
+// Sprite layout (0 = no sprite, 1 - hangman, 2 - barrel, 3 - armor_suit, 4 - bed, 5 - plant, 6 - sink, 7 - dead_plant, 8 - light), editable at runtime
+static char map_sprites[] = {
     0,0,0,0,0,0,0,0,                  
     0,2,0,0,5,0,6,0,                  
     0,0,0,8,0,0,8,0,                  
@@ -77,34 +192,367 @@ static const char map_sprites[] = {
     0,0,0,0,0,0,0,0,                  
 };
 
+// Rectangle of framebuffer covered by 3D view
+typedef struct {
+    int x, y;                                                           // Top left corner
+    int width, height;                                                  // Size in pixels (width also sets projection scale)
+} Viewport;
+
 // Global variables
-uint32_t *pixels = NULL;                                                // Framebuffer for pixel data
-bool engine_on = true;                                                  // Main game loop control flag
+_Thread_local Viewport viewport = { 512, 0, SCREEN_WIDTH - 512, SCREEN_HEIGHT }; // 3D view rectangle of current render target
+_Thread_local uint32_t *pixels = NULL;                                  // Framebuffer for pixel data (every render thread targets its own)
+_Thread_local uint32_t *surfaces = NULL;                                // Surface buffer of current target (NULL = shade pixels directly)
+uint32_t *surface_buffer = NULL;                                        // Surface records of player view (deferred shading)
+_Thread_local uint32_t *object_ids = NULL;                              // Object id buffer of current target (NULL = not collected)
+uint32_t *object_buffer = NULL;                                         // Object ids of player view (crosshair picking)
+volatile sig_atomic_t engine_on = true;                                 // Main game loop control flag (cleared from signal handler)
+unsigned int scene_generation = 0;                                      // Bumped on every visible change (camera, map edits, assets)
+
+// Runtime metrics. Render threads only add to 32-bit atomic counters (lock-free), metrics thread periodically
+// swaps them to zero and accumulates them into 64-bit totals, so counters never overflow on long-running instances
+enum {
+    METRIC_FRAMES,                                                      // Rendered frames
+    METRIC_FRAMES_REUSED,                                               // Frames shown again without rendering (frame cache hit)
+    METRIC_FRAMES_RENDERED,                                             // Game loop frames rendered again (frame cache miss)
+    METRIC_FRAME_US,                                                    // Sum of frame render times in microseconds
+    METRIC_FRAME_BUCKET,                                                // Frames per render time bucket (non-cumulative)
+    METRIC_STAGE_MAP_US = METRIC_FRAME_BUCKET + METRICS_FRAME_BUCKETS,  // Time spent in 2D map stage
+    METRIC_STAGE_SCENE_US,                                              // Time spent in 3D scene stage
+    METRIC_STAGE_HUD_US,                                                // Time spent in HUD / debug view stage
+    METRIC_STAGE_UPLOAD_US,                                             // Time spent uploading frame to texture
+    METRIC_STAGE_OVERLAY_US,                                            // Time spent drawing rays over 2D map
+    METRIC_CRITICAL_PATH_US,                                            // Longest chain of dependent frame stages
+    METRIC_RAYS,                                                        // Rays (screen columns) cast
+    METRIC_SPRITES,                                                     // Sprites drawn (at least one column visible)
+    METRIC_PARTICLES_DRAWN,                                             // Particles drawn (billboard passed depth test)
+    METRIC_PARTICLES_CULLED,                                            // Particles behind camera, off screen or behind walls
+    METRIC_PARTICLES_OVER_BUDGET,                                       // Particles skipped by PARTICLE_DRAW_BUDGET
+    METRIC_PARTICLES_DROPPED,                                           // Spawns dropped because MAX_PARTICLES are alive
+    METRIC_COUNT
+};
+static const double metrics_bucket_ms[METRICS_FRAME_BUCKETS] = { 1, 2, 4, 8, 16, 33, 66, 100 }; // Upper bounds of buckets
+SDL_atomic_t metric_pending[METRIC_COUNT];                              // Counts added since last drain
+uint64_t metric_total[METRIC_COUNT];                                    // Drained totals (owned by metrics thread)
+SDL_atomic_t metrics_on;                                                // Metrics thread run flag
+SDL_Thread *metrics_thread = NULL;                                      // Metrics thread handle (NULL = no endpoint)
+
+// Scene types - dungeon raycaster or heightmap terrain (F6 switches, --terrain starts with terrain)
+enum { SCENE_DUNGEON, SCENE_TERRAIN };
+int scene_type = SCENE_DUNGEON;                                         // Active scene type
+
+// Heightmap terrain - generated on first use, read-only afterwards (shared by all render threads)
+uint8_t terrain_height[TERRAIN_SIZE * TERRAIN_SIZE];                    // Ground height of every texel
+uint32_t terrain_color[TERRAIN_SIZE * TERRAIN_SIZE];                    // Lit ground colour of every texel
+bool terrain_ready = false;                                             // Terrain was generated
+
+// Debug heatmap views replacing shaded 3D output (F3 cycles through them)
+enum { DEBUG_VIEW_OFF, DEBUG_VIEW_OVERDRAW, DEBUG_VIEW_TRAVERSAL, DEBUG_VIEW_STRIP_TIME, DEBUG_VIEW_COUNT };
+int debug_view = DEBUG_VIEW_OFF;                                        // Active debug view
+bool bilinear_filter = false;                                           // Bilinear filtering of walls and floors (F7 toggles)
+bool deferred_shading = false;                                          // Two-pass rendering through surface buffer (F2 toggles)
+float view_distance = 0;                                                // Farthest visible distance in world units (0 = unlimited, F11 cycles)
+float fog_scale[FOG_LEVELS] = { 1.0f };                                 // Brightness left to surface at every fog level
+uint32_t fog_add[FOG_LEVELS];                                           // Fog colour added at every fog level (no alpha)
+uint8_t debug_overdraw[SCREEN_WIDTH * SCREEN_HEIGHT];                   // Writes per pixel in current frame
+int debug_column_cells[RAY_COUNT];                                      // Map cells tested by every ray
+Uint64 debug_strip_time[RAY_COUNT / DEBUG_STRIP_RAYS];                  // Render time of every strip of rays
+
+// Callback for worker pool job, index is number of item in batch
+typedef void (*JobFunc)(void *data, int index);
+
+// Batch of job items processed by worker pool (lives on stack of jobs_run() caller)
+typedef struct JobBatch {
+    JobFunc func;                                                       // Function called for every item
+    void *data;                                                         // User data passed to function
+    int count;                                                          // Number of items
+    SDL_atomic_t next;                                                  // Next item to be claimed
+    SDL_atomic_t done;                                                  // Number of finished items
+    int users;                                                          // Workers currently claiming items (protected by job_lock)
+    struct JobBatch *next_batch;                                        // Next batch in active list
+} JobBatch;
+
+// Worker pool state
+SDL_Thread *job_threads[MAX_WORKERS];                                   // Worker thread handles
+int job_thread_count = 0;                                               // Number of running workers (0 = jobs run on caller thread)
+SDL_mutex *job_lock = NULL;                                             // Protects active batch list and worker wake-ups
+SDL_cond *job_wake = NULL;                                              // Signals workers that new batch is available
+SDL_cond *job_finished = NULL;                                          // Signals callers that batch may be complete
+JobBatch *job_active = NULL;                                            // Batches with unclaimed or unfinished items
+bool job_quit = false;                                                  // Asks workers to exit
+
+// Game loop frame stages, in order of declaration
+enum { STAGE_MAP, STAGE_SCENE, STAGE_OVERLAY, STAGE_HUD, STAGE_COUNT };
+
+// Pixel data of every asset, starts with the compiled-in arrays of asset/assets.h (entries are swapped by asset hot-reload)
+const uint32_t *asset_pixels[ASSET_COUNT] = {
+    ground, ceiling, greystone, mossy, colorstone,
+    hangman, barrel, armor_suit, bed, plant, sink, dead_plant, light,
+    pistol, hud,
+};
+
+// Asset hot-reload state (only touched by main thread, except asset_pending which is handed over by watcher thread)
+uint32_t *asset_loaded[ASSET_COUNT];                                    // Reloaded pixel buffers owned by engine (NULL = compiled-in asset)
+void *asset_pending[ASSET_COUNT];                                       // Freshly imported buffers waiting to be swapped in between frames
+SDL_atomic_t asset_watch_on;                                            // Watcher thread run flag
+SDL_Thread *asset_watch_thread = NULL;                                  // Watcher thread handle (NULL = hot-reload inactive)
+
+// Video capture state - single producer (game loop) / single consumer (writer thread) ring of frames
+uint32_t *capture_ring[CAPTURE_RING_SIZE];                              // Preallocated frame buffers
+SDL_atomic_t capture_head;                                              // Number of frames pushed by game loop
+SDL_atomic_t capture_tail;                                              // Number of frames written by writer thread
+SDL_atomic_t capture_on;                                                // Writer thread run flag
+SDL_sem *capture_ready = NULL;                                          // Signals writer that frame was pushed
+SDL_Thread *capture_thread = NULL;                                      // Writer thread handle (NULL = not recording)
+FILE *capture_file = NULL;                                              // Output file
+bool capture_y4m = false;                                               // true = Y4M (YUV 4:4:4), false = raw ARGB frames
+uint8_t *capture_planes = NULL;                                         // Y, U and V planes of one frame (Y4M only, writer thread)
+int capture_dropped = 0;                                                // Frames dropped because writer fell behind
+
+// What camera saw in last rendered frame - by-product of ray pass for game logic (AI wake-up, fog of war, prefetch)
+typedef struct {
+    uint32_t cells[(MAPX * MAPY + 31) / 32];                            // Bitset of map cells reached by rays (hit walls included)
+    int sprite_count;                                                   // Number of visible sprites
+    int sprites[MAPX * MAPY];                                           // Ids of visible sprites (map index of sprite cell), no duplicates
+} Visibility;
+
+// Object classes of object id buffer (OBJECT_ID: class in bits 28-31, wall/sprite type in bits 20-27, instance in bits 0-19).
+// Instance is map index of cell for walls, wall tops, floor, ceiling and sprites, terrain texel index for terrain
+// (texel rows from TERRAIN_ID_ROWS on continue in type, so instance never reaches OBJECT_NO_INSTANCE)
+enum { OBJECT_NONE, OBJECT_WALL, OBJECT_WALL_TOP, OBJECT_FLOOR, OBJECT_CEILING, OBJECT_SPRITE, OBJECT_TERRAIN, OBJECT_SKY, OBJECT_CLASS_COUNT };
+static const char *object_class_names[OBJECT_CLASS_COUNT] = { "nothing", "wall", "wall top", "floor", "ceiling", "sprite", "terrain", "sky" };
 
 // Player structure definition
 struct Player {
-    float x;                                                            // Player X position in world coordinates
-    float y;                                                            // Player Y position in world coordinates
+    int cell_x;                                                         // Map cell of player (X)
+    int cell_y;                                                         // Map cell of player (Y)
+    float off_x;                                                        // X offset inside cell (0 - MAP_CELL_SIZE), precise on any map size
+    float off_y;                                                        // Y offset inside cell (0 - MAP_CELL_SIZE)
     float dx;                                                           // X component of direction vector
     float dy;                                                           // Y component of direction vector
     float angle;                                                        // Player facing angle in degrees
+    float pitch;                                                        // Vertical look offset of horizon in pixels (0 = straight ahead)
     float rays_d[RAY_COUNT];                                            // Array storing distances for each ray
+    int ray_count;                                                      // Rays of last rendered view (entries of rays_d in use)
+    int hit_face;                                                       // Wall face hit by centre ray (cell * 4 + FACE_*, -1 = none)
+    int hit_u;                                                          // Texture column of wall where centre ray hit it
+    Visibility *visibility;                                             // Filled by r_raycast() when set (NULL = not collected)
 };
 
+Visibility player_visibility;                                           // Visible cells and sprites of player view
+uint32_t *pip_pixels = NULL;                                            // Framebuffer of picture-in-picture view
+bool pip_on = false;                                                    // Picture-in-picture security camera (F4 toggles)
+
 // Initialize player with starting values
 struct Player player = {
-    .x = 200,                                                           // Starting X position
-    .y = 195,                                                           // Starting Y position
+    .cell_x = 3, .off_x = 8,                                            // Starting X position (world 200)
+    .cell_y = 3, .off_y = 3,                                            // Starting Y position (world 195)
     .angle = 295.0,                                                     // Starting angle (facing north)
     .dx = 0.423,                                                        // cos(295°) ≈ 0.423
-    .dy = 0.906                                                         // -sin(295°) ≈ 0.906
+    .dy = 0.906,                                                        // -sin(295°) ≈ 0.906
+};
+
+// Fixed security camera shown in picture-in-picture view
+struct Player security_cam = {
+    .cell_x = 1, .off_x = 32,
+    .cell_y = 6, .off_y = 32,
+    .angle = 40.0,
+    .dx = 0.766,                                                        // cos(40°)
+    .dy = -0.643,                                                       // -sin(40°)
+};
+
+// Pose of simulated entity (camera position and orientation)
+typedef struct {
+    int cell_x, cell_y;                                                 // Map cell
+    float off_x, off_y;                                                 // Offset inside cell
+    float angle;                                                        // Facing angle in degrees
+    float pitch;                                                        // Vertical look offset of horizon in pixels
+} SimPose;
+
+// Simulated entities published to renderer
+enum { SIM_PLAYER, SIM_SECURITY_CAM, SIM_ENTITY_COUNT };
+
+// Held movement keys handed from event loop to simulation
+enum { SIM_KEY_LEFT = 1, SIM_KEY_RIGHT = 2, SIM_KEY_FORWARD = 4, SIM_KEY_BACK = 8 };
+
+// Immutable simulation state published once per tick - renderer interpolates between prev and cur
+typedef struct {
+    SimPose prev[SIM_ENTITY_COUNT];                                     // Poses at start of tick
+    SimPose cur[SIM_ENTITY_COUNT];                                      // Poses at end of tick
+    Uint64 time;                                                        // Performance counter when tick was published
+} SimState;
+
+// Simulation thread state. Simulation thread owns poses in player and security_cam (main thread changes them only
+// under sim_lock), renderer sees them through triple buffer: publisher and reader own one slot each, third is handed over
+#define SIM_FRESH 4                                                     // Handed over slot holds state not read yet
+SimState sim_slots[3];                                                  // Triple buffer of published states
+SDL_atomic_t sim_middle;                                                // Index of handed over slot (+ SIM_FRESH)
+int sim_back = 0;                                                       // Slot filled by publisher (protected by sim_lock)
+int sim_front = 1;                                                      // Slot read by renderer (main thread)
+SDL_atomic_t sim_keys;                                                  // Held movement keys (SIM_KEY_* bits) from event loop
+SDL_atomic_t sim_on;                                                    // Simulation thread run flag
+SDL_mutex *sim_lock = NULL;                                             // Held while poses change (simulation tick or teleport)
+SDL_Thread *sim_thread = NULL;                                          // Simulation thread handle (NULL = not running)
+uint32_t sim_tick_count = 0;                                            // Ticks simulated so far
+
+// Interpolated cameras rendered in current frame (main thread)
+struct Player view_player = {
+    .visibility = &player_visibility                                    // Game logic can ask what player sees
+};
+struct Player view_security_cam;
+
+// Render service protocol (Unix SOCK_SEQPACKET socket, one struct per message):
+// 1. After connect server sends ServiceHello together with shared memory fd (SCM_RIGHTS) holding ring of frames.
+//    Every slot holds ARGB frame followed by object id buffer of same size (segmentation, see OBJECT_ID)
+// 2. Client sends RenderRequest with up to SERVICE_RING_SLOTS poses
+// 3. Server renders every pose directly into next ring slot and answers with RenderReply listing used slots.
+//    Request without poses resets engine state to snapshot taken at service start (--snapshot file, if given)
+//    and is answered with empty reply
+// Slots are reused round-robin, so frame stays valid until client requests SERVICE_RING_SLOTS more frames
+typedef struct {
+    uint32_t width, height;                                             // Frame size in pixels (ARGB8888, full framebuffer)
+    uint32_t slots;                                                     // Number of frames in ring
+    uint32_t slot_size;                                                 // Size of one slot in bytes
+    uint32_t ids_offset;                                                // Offset of object id buffer inside slot in bytes
+} ServiceHello;
+
+typedef struct {
+    float x, y, angle, pitch;                                           // Camera pose like in batch pose file
+} RenderPose;
+
+typedef struct {
+    uint32_t count;                                                     // Number of poses in request
+    RenderPose poses[SERVICE_RING_SLOTS];                               // Poses to render
+} RenderRequest;
+
+typedef struct {
+    uint32_t count;                                                     // Number of rendered frames
+    uint32_t slots[SERVICE_RING_SLOTS];                                 // Ring slot of every frame (same order as poses)
+} RenderReply;
+
+// Particles in structure of arrays layout, so update runs on four particles at once. Particles are visual only:
+// main thread updates them between frames and render threads only read them
+typedef struct {
+    int cell_x[MAX_PARTICLES], cell_y[MAX_PARTICLES];                   // Map cell
+    float off_x[MAX_PARTICLES], off_y[MAX_PARTICLES];                   // Offset inside cell
+    float z[MAX_PARTICLES];                                             // Height above floor
+    float vx[MAX_PARTICLES], vy[MAX_PARTICLES], vz[MAX_PARTICLES];      // Velocity in world units per second
+    float life[MAX_PARTICLES];                                          // Seconds left
+    float fade[MAX_PARTICLES];                                          // 1 / total lifetime, colour fades out with life
+    uint32_t color[MAX_PARTICLES];                                      // Premultiplied colour (alpha 0 = additive glow)
+    int count;                                                          // Live particles (first count entries)
+} Particles;
+
+// Faces of wall cell, in order of face index (cell * 4 + face)
+enum { FACE_WEST, FACE_EAST, FACE_NORTH, FACE_SOUTH };
+
+// Decal images in decal atlas
+enum { DECAL_BULLET_HOLE, DECAL_BLOOD, DECAL_SIGN, DECAL_TYPE_COUNT };
+
+// Rectangle of decal atlas
+typedef struct {
+    int x, y, w, h;                                                     // Position and size in atlas texels
+} DecalRect;
+
+// Decal placed on wall face, positioned in texel coordinates of wall texture (v counts from top of wall, not wrapped)
+typedef struct {
+    short u, v;                                                         // Top left texel on face
+    uint8_t type;                                                       // DECAL_* image
+    uint32_t stamp;                                                     // Time of placement or last hit (lowest is evicted first)
+} Decal;
+
+static const DecalRect decal_rects[DECAL_TYPE_COUNT] = {
+    [DECAL_BULLET_HOLE] = { 0, 0, 8, 8 },
+    [DECAL_BLOOD]       = { 8, 0, 16, 16 },
+    [DECAL_SIGN]        = { 0, 16, 32, 16 },
 };
+uint32_t decal_atlas[DECAL_ATLAS_SIZE * DECAL_ATLAS_SIZE];              // Premultiplied decal images (generated at startup)
+Decal decal_faces[MAPX * MAPY * 4][DECALS_PER_FACE];                    // Decals of every wall face
+uint8_t decal_count[MAPX * MAPY * 4];                                   // Decals on face (0 = face is drawn without decal work)
+uint32_t decal_clock = 0;                                               // Placement and hit counter for LRU eviction
+
+Particles particles;                                                    // All live particles
+Uint64 particles_time = 0;                                              // Performance counter of last particle update
+uint32_t particles_seed = 0x9E3779B9;                                   // Random state of particle spawns
+
+// Camera pose stored in snapshot
+typedef struct {
+    int cell_x, cell_y;                                                 // Map cell
+    float off_x, off_y;                                                 // Offset inside cell
+    float dx, dy;                                                       // Direction vector
+    float angle;                                                        // Facing angle in degrees
+    float pitch;                                                        // Vertical look offset
+} SnapshotPose;
+
+// Engine state snapshot - world state (cameras, simulation tick, map, decals, particles and their random state) in one
+// flat block, so save/restore is plain copy. Assets and render options are not part of snapshot
+typedef struct {
+    uint32_t magic;                                                     // SNAPSHOT_MAGIC
+    uint32_t version;                                                   // SNAPSHOT_VERSION
+    SnapshotPose player;                                                // Player pose
+    SnapshotPose security_cam;                                          // Security camera pose
+    uint32_t sim_tick_count;                                            // Simulation ticks (security camera sweep phase)
+    char map[MAPX * MAPY];                                              // Walls including runtime edits
+    char map_sprites[MAPX * MAPY];                                      // Sprites including runtime edits
+    Decal decal_faces[MAPX * MAPY * 4][DECALS_PER_FACE];                // Decals of every wall face
+    uint8_t decal_count[MAPX * MAPY * 4];                               // Decals on every face
+    uint32_t decal_clock;                                               // Decal placement counter
+    Particles particles;                                                // Live particles
+    uint32_t particles_seed;                                            // Random state of particle spawns
+} Snapshot;
+
+Snapshot quicksave;                                                     // In-memory quicksave slot (also start state of --snapshot)
+bool quicksave_valid = false;                                           // Quicksave slot holds snapshot
+
+// Walls of one screen column in front to back order, used to clip sprites against walls of different heights
+typedef struct {
+    int count;                                                          // Number of recorded walls
+    float dist[MAX_COLUMN_OCCLUDERS];                                   // Perpendicular distance of wall
+    int clip[MAX_COLUMN_OCCLUDERS];                                     // Rows from this one down are covered by geometry up to this wall
+} ColumnOcclusion;
+
+// Floor and ceiling rows of one screen column, recorded by ray pass and filled tile by tile afterwards
+typedef struct {
+    float dir_x, dir_y;                                                 // Ray direction
+    double cos_a;                                                       // Fisheye correction factor
+    int floor_count;                                                    // Number of floor spans
+    short floor_y0[MAX_COLUMN_OCCLUDERS + 1], floor_y1[MAX_COLUMN_OCCLUDERS + 1]; // Floor rows [y0, y1) between walls
+    short ceil_y0, ceil_y1;                                             // Ceiling rows [y0, y1)
+} ColumnPlanes;
+
+// Per-frame state shared by all views of frame - gathered once, read-only while views render
+typedef struct {
+    int sprite_count;                                                   // Number of sprites on map
+    int sprite_cell[MAPX * MAPY];                                       // Map index of sprite cell
+    int sprite_type[MAPX * MAPY];                                       // Sprite type
+    const uint32_t *ground, *ceiling;                                   // Floor and ceiling textures of frame
+} SceneFrame;
+
+// One camera rendered into rectangle of framebuffer
+typedef struct {
+    struct Player *cam;                                                 // Camera to render
+    uint32_t *target;                                                   // Framebuffer (SCREEN_WIDTH x SCREEN_HEIGHT)
+    Viewport rect;                                                      // Part of framebuffer covered by view
+    uint32_t *surfaces;                                                 // Surface buffer for deferred shading (NULL = shade directly)
+    uint32_t *object_ids;                                               // Object id of every pixel, written with colour (NULL = not collected)
+    bool frame;                                                         // Target is standalone frame - clear it first and count it in metrics
+} View;
+
+// Node of frame job graph. Stage runs once all its dependencies finished; ready stages whose framebuffer
+// regions don't overlap run side by side on worker pool, overlapping ones keep order of declaration
+typedef struct {
+    void (*run)(void);                                                  // Stage body, draws into pixels
+    uint32_t deps;                                                      // Bitmask of stages which must finish first
+    Viewport region;                                                    // Framebuffer rectangle written by stage
+    int metric;                                                         // Metric receiving stage time (-1 = stage counts itself)
+    Uint64 us;                                                          // Stage duration in microseconds (filled by stages_run())
+} FrameStage;
 
 // Struct for sprite render data
 typedef struct {
-    float x, y;                                                         // World position
+    float x, y;                                                         // Position relative to camera (small numbers on any map size)
     float dist;                                                         // Distance from player
     int type;                                                           // Sprite type
+    int id;                                                             // Sprite id (map index of its cell)
 } Sprite;
 
 // Function declarations
@@ -115,13 +563,73 @@ void r_drawline(int x0, int y0, int x1, int y1, uint32_t color);        // Draw
 void r_drawplayer(int x, int y, uint32_t color);                        // Draw player representation
 void r_drawrectangle(int x, int y, int size, uint32_t color);           // Draw filled rectangle
 void r_drawlevel(void);                                                 // Draw 2D map view
-void r_raycast(void);                                                   // Main raycasting function
-uint32_t* r_get_wall_texture(int wall_type);                            // Get correct texture for wall rendering
-uint32_t* r_get_sprite(int sprite_type);                                // Get correct sprite image for rendering
-void r_render_sprites(float *wall_distances, int column_width);         // Draw sprites
+void r_raycast(struct Player *cam, const SceneFrame *frame);            // Main raycasting function
+const uint32_t* r_get_wall_texture(int wall_type);                      // Get correct texture for wall rendering
+const uint32_t* r_get_sprite(int sprite_type);                          // Get correct sprite image for rendering
+int r_wall_asset(int wall_type);                                        // Asset id of wall texture
+int r_sprite_asset(int sprite_type);                                    // Asset id of sprite image
+void r_resolve_surfaces(void);                                          // Deferred shading pass over current viewport
+void r_set_view_distance(float cells);                                  // Set view distance in cells (0 = unlimited), build fog tables
+void r_render_sprites(struct Player *cam, const SceneFrame *frame, float *wall_distances, ColumnOcclusion *occlusion,
+                      int column_width);                                // Draw sprites
 void r_draw_hud();                                                      // Draw HUD - only pistol and demo HUD with no function
+void r_draw_debug_view(void);                                           // Replace 3D view with active debug heatmap
+void r_draw_rays(struct Player *cam);                                   // Draw rays of last rendered view into 2D map
+void r_clear_rect(Viewport rect);                                       // Clear part of framebuffer to background color
 void process_inputs(void);                                              // Handle user input
-bool check_collision(float x, float y);                                 // Collision detection
+bool check_collision(int cell_x, int cell_y, float off_x, float off_y);  // Collision detection
+void sim_start(void);                                                   // Start simulation thread
+void sim_stop(void);                                                    // Stop simulation thread
+void sim_reset(void);                                                   // Publish poses changed outside tick (caller holds sim_lock)
+bool sim_interpolate(void);                                             // Update view cameras from latest state, true if they moved
+uint32_t* a_load_ppm(const char *path, int width, int height);          // Load .ppm image (P3 or P6) into new ARGB buffer
+void a_hotreload_start(void);                                           // Start watching asset sources for changes
+void a_hotreload_stop(void);                                            // Stop watcher thread and free reloaded assets
+void a_premultiply(uint32_t *buffer, int count);                        // Convert magenta colour key to premultiplied alpha
+void a_prepare_assets(void);                                            // Replace colour keyed compiled-in assets by alpha copies
+void a_free_assets(void);                                               // Free asset buffers owned by engine
+void a_apply_reloads(void);                                             // Swap freshly imported assets into asset table
+bool v_capture_start(const char *path, bool y4m);                       // Start recording frames to file
+void v_capture_stop(void);                                              // Stop recording, write remaining frames
+void v_capture_frame(const uint32_t *frame);                            // Hand finished frame to writer (drops frame if writer is busy)
+void jobs_init(int threads);                                            // Start worker pool
+void jobs_shutdown(void);                                               // Stop worker pool
+void jobs_run(JobFunc func, void *data, int count);                     // Run count items on worker pool and wait for them
+Uint64 stages_run(FrameStage *stages, int count);                       // Run frame job graph, returns critical path in microseconds
+int batch_render(const char *pose_file, const char *out_dir);           // Headless rendering of camera pose list to images
+int service_run(const char *socket_path);                               // Serve rendered frames to local clients
+void snapshot_save(Snapshot *snap);                                     // Capture engine state into snapshot
+void snapshot_restore(const Snapshot *snap);                            // Reset engine state from snapshot
+bool snapshot_write(const Snapshot *snap, const char *path);            // Store snapshot to disk
+bool snapshot_read(Snapshot *snap, const char *path);                   // Load snapshot from disk
+bool m_crosshair_hit(struct Player *cam, float *x, float *y, float *z); // Point where centre ray of last frame hit wall (from camera cell)
+void d_init(void);                                                      // Generate decal atlas and place map signs
+void d_add(int cell, int face, int type, int u, int v);                 // Place decal centred on face texel
+void d_shoot(struct Player *cam, bool blood);                           // Bullet hole (or blood) where crosshair hits wall
+void p_spawn(int cell_x, int cell_y, float x, float y, float z, float vx, float vy, float vz, float life, uint32_t color); // Add particle
+bool p_update(void);                                                    // Move particles, true while any is alive
+void p_fire(struct Player *cam);                                        // Muzzle flash and impact of shot along view direction
+void p_render(struct Player *cam, const float *wall_distances, const ColumnOcclusion *occlusion, int column_width); // Draw particles
+bool vis_cell_visible(const Visibility *vis, int x, int y);             // Was map cell seen in last frame
+bool vis_sprite_visible(const Visibility *vis, int x, int y);           // Was sprite in map cell seen in last frame
+uint32_t vis_pick(int x, int y);                                        // Object id of player view pixel
+void vis_print_object(uint32_t id);                                     // Print object id in readable form
+void r_render_scene(struct Player *cam);                                // Render 3D view of active scene type
+void r_render_views(const View *views, int count);                      // Render several cameras at once on worker pool
+void r_blit_view(const View *view, uint32_t *frame);                    // Copy view rectangle into frame with border
+static void r_stage_map(void);                                          // Frame stage - 2D map
+static void r_stage_scene(void);                                        // Frame stage - 3D view
+static void r_stage_overlay(void);                                      // Frame stage - rays over 2D map
+static void r_stage_hud(void);                                          // Frame stage - debug heatmap and HUD
+void metrics_add(int metric, int value);                                // Add to runtime metric counter
+Uint64 metrics_since(Uint64 start);                                     // Microseconds since performance counter value
+void metrics_frame(Uint64 start);                                       // Count finished frame which started at performance counter value
+bool metrics_start(const char *endpoint);                               // Serve metrics on Unix socket path or loopback TCP port
+void metrics_stop(void);                                                // Stop metrics endpoint
+void t_terrain_init(void);                                              // Generate heightmap terrain
+void t_set_scene(int type);                                             // Switch between dungeon and terrain
+void t_render_terrain(struct Player *cam);                              // Render heightmap terrain into 3D view
+void t_draw_terrain_map(struct Player *cam);                            // Draw terrain colour map with player position
 
 // Utility math functions
 float m_deg_to_rad(float a) { return a * PI / 180; }                    // Convert degrees to radians
@@ -131,8 +639,88 @@ float m_fix_ang(float a) {                                              // Norma
     return a;                                                           // Return normalized angle
 }
 
+// Move whole cells from offset to cell index, so offset stays in 0 - MAP_CELL_SIZE range
+void m_cell_normalize(int *cell, float *offset) {
+    int carry = (int)floorf(*offset / MAP_CELL_SIZE);                   // Whole cells in offset
+    *cell += carry;
+    *offset -= carry * MAP_CELL_SIZE;
+    if (*offset >= MAP_CELL_SIZE) {                                     // Tiny negative offset rounds up to full cell
+        *offset -= MAP_CELL_SIZE;
+        (*cell)++;
+    }
+}
+
+// Set camera position from absolute world coordinates (pose files, service requests)
+void m_set_world_pos(struct Player *cam, double x, double y) {
+    cam->cell_x = (int)floor(x / MAP_CELL_SIZE);
+    cam->cell_y = (int)floor(y / MAP_CELL_SIZE);
+    cam->off_x = (float)(x - (double)cam->cell_x * MAP_CELL_SIZE);
+    cam->off_y = (float)(y - (double)cam->cell_y * MAP_CELL_SIZE);
+    m_cell_normalize(&cam->cell_x, &cam->off_x);
+    m_cell_normalize(&cam->cell_y, &cam->off_y);
+}
+
 // Main program entry point
-int main() {
+int main(int argc, char *argv[]) {
+    // Options valid in every mode
+    const char *snapshot_path = NULL;                                   // Start state of world (--snapshot)
+    while (argc > 1) {
+        if (strcmp(argv[1], "--terrain") == 0) {                        // Heightmap terrain instead of dungeon
+            t_set_scene(SCENE_TERRAIN);
+        } else if (strcmp(argv[1], "--bilinear") == 0) {                // Bilinear texture filtering
+            bilinear_filter = true;
+        } else if (strcmp(argv[1], "--view-distance") == 0 && argc > 2) { // Draw distance in cells with fog
+            r_set_view_distance((float)atof(argv[2]));
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--metrics") == 0 && argc > 2) {     // Prometheus metrics endpoint
+            if (!metrics_start(argv[2])) return -1;
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--snapshot") == 0 && argc > 2) {    // Start from saved engine state
+            snapshot_path = argv[2];
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+
+    a_prepare_assets();                                                 // Every mode renders sprites with alpha
+    d_init();                                                           // Decal atlas and map signs
+    if (snapshot_path) {                                                // Replaces default world, F8 and service resets return to it
+        if (!snapshot_read(&quicksave, snapshot_path)) {
+            printf("Snapshot: cannot load '%s'\n", snapshot_path);
+            a_free_assets();
+            metrics_stop();
+            return -1;
+        }
+        quicksave_valid = true;
+        snapshot_restore(&quicksave);
+    }
+
+    // Headless batch rendering mode doesn't need window at all
+    if (argc == 4 && strcmp(argv[1], "--batch") == 0) {
+        int result = batch_render(argv[2], argv[3]);
+        a_free_assets();
+        metrics_stop();
+        return result;
+    }
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {               // Render service for local clients
+        int result = service_run(argv[2]);
+        a_free_assets();
+        metrics_stop();
+        return result;
+    }
+    if (argc > 1) {
+        printf("Usage: %s [--terrain] [--bilinear] [--view-distance <cells>] [--metrics <socket_path|port>] [--snapshot <file>] [--batch <pose_file> <output_dir> | --serve <socket_path>]\n", argv[0]);
+        a_free_assets();
+        metrics_stop();
+        return -1;
+    }
+
     // Initialize SDL video subsystem and check for errors
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {                                // Initialize SDL video subsystem
         printf("SDL_Init ERROR: Have you installed SDL library in your system?\n"); // Print error message
@@ -161,6 +749,7 @@ int main() {
     // Cleanup and shutdown
     SDL_DestroyRenderer(renderer);                                      // Destroy renderer
     SDL_DestroyWindow(window);                                          // Destroy window
+    metrics_stop();                                                     // Stop metrics endpoint (if any)
     SDL_Quit();                                                         // Shutdown SDL
     return 0;                                                           // Exit program successfully
 }
@@ -179,35 +768,70 @@ void rungame(SDL_Renderer *renderer) {
     
     // Allocate memory for framebuffer (4 bytes per pixel for ARGB)
     pixels = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    pip_pixels = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);              // Picture-in-picture renders next to main view, not over it
+    surface_buffer = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, 4);           // Surface records of player view (deferred shading)
+    object_buffer = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, 4);            // Object ids of player view (crosshair picking)
+    a_hotreload_start();                                                // Watch asset sources so artists don't need to rebuild
+    jobs_init(SDL_GetCPUCount() - 2);                                   // Workers for render stages, one core is left to simulation
+    sim_start();                                                        // Player and entities move on their own thread
+    unsigned int drawn_generation = scene_generation - 1;               // Scene generation in framebuffer (differs to force first frame)
     
     // Main game loop - runs until engine_on becomes false
     while (engine_on) {
-        process_inputs();                                               // Handle keyboard input and update player
-        r_clearscreenbuffer();                                          // Clear framebuffer to background color
-        r_drawlevel();                                                  // Draw 2D map representation
-        r_drawplayer(player.x, player.y, 0xffff0090);                   // Draw player as colored square
-        r_raycast();                                                    // Perform raycasting draw map view and render 3D view
-        r_draw_hud();                                                   // Lastly HUD is drawn over rendered scene
-        
-        // Update display
-        SDL_UpdateTexture(texture,                                      // Texture to update
-                         NULL,                                          // Update entire texture
-                         pixels,                                        // Source pixel data
-                         SCREEN_WIDTH * 4);                             // Bytes per row
+        a_apply_reloads();                                              // Swap in changed assets before frame starts
+        process_inputs();                                               // Handle keyboard input and pass held keys to simulation
+        if (sim_interpolate()) scene_generation++;                      // Cameras moved since last frame
+        if (p_update()) scene_generation++;                             // Live particles move every frame
+
+        // Render only when something visible changed, otherwise last frame (already in texture) is shown again
+        if (drawn_generation != scene_generation) {
+            drawn_generation = scene_generation;
+            Uint64 frame_start = SDL_GetPerformanceCounter();           // Frame and stage timing for metrics
+
+            // Map and 3D view touch disjoint pixels, so do ray overlay and HUD - frame takes longest chain, not sum
+            const Viewport map_region = { 0, 0, 512, SCREEN_HEIGHT };   // 2D map part of framebuffer
+            FrameStage stages[STAGE_COUNT] = {
+                [STAGE_MAP]     = { r_stage_map, 0, map_region, METRIC_STAGE_MAP_US },
+                [STAGE_SCENE]   = { r_stage_scene, 0, viewport, -1 },
+                [STAGE_OVERLAY] = { r_stage_overlay, 1u << STAGE_MAP | 1u << STAGE_SCENE, map_region, METRIC_STAGE_OVERLAY_US },
+                [STAGE_HUD]     = { r_stage_hud, 1u << STAGE_SCENE, viewport, METRIC_STAGE_HUD_US },
+            };
+            metrics_add(METRIC_CRITICAL_PATH_US, (int)stages_run(stages, STAGE_COUNT));
+
+            // Update display
+            Uint64 stage_start = SDL_GetPerformanceCounter();
+            SDL_UpdateTexture(texture,                                  // Texture to update
+                             NULL,                                      // Update entire texture
+                             pixels,                                    // Source pixel data
+                             SCREEN_WIDTH * 4);                         // Bytes per row
+            metrics_add(METRIC_STAGE_UPLOAD_US, metrics_since(stage_start));
+            metrics_frame(frame_start);
+            metrics_add(METRIC_FRAMES_RENDERED, 1);                     // Scene changed since last frame
+        } else {
+            metrics_add(METRIC_FRAMES_REUSED, 1);                       // Last frame is still valid
+        }
         
         SDL_RenderCopy(renderer, texture, NULL, NULL);                  // Copy texture to renderer
         SDL_RenderPresent(renderer);                                    // Present rendered frame to screen
+        if (capture_thread) v_capture_frame(pixels);                    // Record finished frame
         SDL_Delay(1000 / 100);                                          // Limit to 100 FPS
     }
     
+    sim_stop();                                                         // Stop simulation
+    v_capture_stop();                                                   // Finish recording (if any)
+    a_hotreload_stop();                                                 // Stop asset watcher
+    jobs_shutdown();                                                    // Stop render workers
     SDL_DestroyTexture(texture);                                        // Cleanup texture after game loop quits
     free(pixels);                                                       // Free allocated framebuffer memory
+    free(pip_pixels);
+    free(surface_buffer);
+    free(object_buffer);
 }
 
 // Draw a single pixel to the framebuffer
 void r_drawpoint(int x, int y, uint32_t color) {
-    // Bounds checking to prevent buffer overflow
-    if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) {
+    // Bounds checking to prevent buffer overflow, pixels outside current viewport belong to other view or frame stage
+    if (x < viewport.x || x >= viewport.x + viewport.width || y < viewport.y || y >= viewport.y + viewport.height) {
         return;                                                         // Exit if coordinates out of bounds
     }
     
@@ -219,6 +843,92 @@ void r_drawpoint(int x, int y, uint32_t color) {
     }
     
     pixels[index] = color;                                              // Set pixel color in framebuffer
+    if (debug_view == DEBUG_VIEW_OVERDRAW) debug_overdraw[index]++;     // Count writes for overdraw heatmap
+}
+
+// Write surface record (see SURFACE_RECORD) instead of pixel - shaded later by r_resolve_surfaces()
+static void r_drawsurface(int x, int y, uint32_t record) {
+    if (x < viewport.x || x >= viewport.x + viewport.width || y < viewport.y || y >= viewport.y + viewport.height) {
+        return;                                                         // Same clipping as r_drawpoint()
+    }
+    surfaces[SCREEN_WIDTH * y + x] = record;
+    if (debug_view == DEBUG_VIEW_OVERDRAW) debug_overdraw[SCREEN_WIDTH * y + x]++;
+}
+
+// Fog level of surface at distance along view direction (0 = clear, FOG_LEVELS - 1 = only fog colour is left)
+static inline int r_fog_level(float distance) {
+    if (view_distance <= 0 || distance <= view_distance * FOG_START) return 0;
+    if (distance >= view_distance) return FOG_LEVELS - 1;
+    return (int)((distance - view_distance * FOG_START) / (view_distance * (1.0f - FOG_START)) * (FOG_LEVELS - 1));
+}
+
+// Fog colour added to premultiplied texel of given alpha (fog covers only visible part of texel)
+static inline uint32_t r_fog_premultiplied(int fog, uint32_t alpha) {
+    if (alpha == 255) return fog_add[fog];
+    uint32_t add = fog_add[fog];
+    return (((add >> 16) & 0xFF) * alpha / 255) << 16 | (((add >> 8) & 0xFF) * alpha / 255) << 8 | (add & 0xFF) * alpha / 255;
+}
+
+// Set farthest visible distance in map cells (0 = unlimited). Surfaces fade into FOG_COLOR from FOG_START of it,
+// shade tables hold brightness and added fog colour of every fog level
+void r_set_view_distance(float cells) {
+    view_distance = cells > 0 ? cells * MAP_CELL_SIZE : 0;
+    for (int level = 0; level < FOG_LEVELS; level++) {
+        float f = (float)level / (FOG_LEVELS - 1);                      // Fog fraction of level
+        fog_scale[level] = 1.0f - f;
+        fog_add[level] = (uint32_t)(((FOG_COLOR >> 16) & 0xFF) * f) << 16 | (uint32_t)(((FOG_COLOR >> 8) & 0xFF) * f) << 8 |
+                         (uint32_t)((FOG_COLOR & 0xFF) * f);
+    }
+}
+
+// Write object id (see OBJECT_ID) of pixel, callers check object_ids first
+static void r_drawid(int x, int y, uint32_t id) {
+    if (x < viewport.x || x >= viewport.x + viewport.width || y < viewport.y || y >= viewport.y + viewport.height) {
+        return;                                                         // Same clipping as r_drawpoint()
+    }
+    object_ids[SCREEN_WIDTH * y + x] = id;
+}
+
+// Blend count premultiplied pixels over dst (stride apart): dst = src + dst * (255 - alpha) / 255. Fully transparent
+// texels are skipped and opaque ones copied, SSE2 blends pairs of translucent pixels and matches scalar version exactly
+static void r_blend_span(uint32_t *dst, int stride, const uint32_t *src, int count) {
+    int i = 0;
+    while (i < count) {
+        uint32_t alpha = src[i] >> 24;
+        if (alpha == 0) {                                               // Nothing to draw
+            i++;
+            continue;
+        }
+        if (alpha == 255) {                                             // Opaque texel covers pixel
+            dst[i * stride] = src[i];
+            i++;
+            continue;
+        }
+#ifdef __SSE2__
+        if (i + 1 < count && (src[i + 1] >> 24) - 1 < 254) {           // Next texel is translucent too
+            const __m128i zero = _mm_setzero_si128();
+            int inv0 = 255 - alpha, inv1 = 255 - (src[i + 1] >> 24);
+            __m128i d = _mm_unpacklo_epi32(_mm_cvtsi32_si128(dst[i * stride]), _mm_cvtsi32_si128(dst[(i + 1) * stride]));
+            __m128i s = _mm_unpacklo_epi32(_mm_cvtsi32_si128(src[i]), _mm_cvtsi32_si128(src[i + 1]));
+            __m128i x = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_set_epi16(inv1, inv1, inv1, inv1, inv0, inv0, inv0, inv0));
+            x = _mm_add_epi16(x, _mm_set1_epi16(128));
+            x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8); // Exact division by 255
+            __m128i out = _mm_or_si128(_mm_adds_epu8(_mm_packus_epi16(x, zero), s), _mm_set1_epi32((int)0xFF000000));
+            dst[i * stride] = (uint32_t)_mm_cvtsi128_si32(out);
+            dst[(i + 1) * stride] = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out, 4));
+            i += 2;
+            continue;
+        }
+#endif
+        uint32_t out = 0xFF000000;                                      // Scalar version (single translucent texel or no SSE2)
+        for (int shift = 0; shift < 24; shift += 8) {
+            uint32_t x = ((dst[i * stride] >> shift) & 0xFF) * (255 - alpha) + 128;
+            uint32_t c = ((src[i] >> shift) & 0xFF) + ((x + (x >> 8)) >> 8);
+            out |= (c > 255 ? 255 : c) << shift;
+        }
+        dst[i * stride] = out;
+        i++;
+    }
 }
 
 // Draw line using Bresenham's line algorithm
@@ -260,6 +970,13 @@ void r_clearscreenbuffer(void) {
     memset(pixels, 0xFFBBBBBB, 4 * SCREEN_WIDTH * SCREEN_HEIGHT);
 }
 
+// Clear part of framebuffer to same background color
+void r_clear_rect(Viewport rect) {
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        memset(pixels + y * SCREEN_WIDTH + rect.x, 0xFFBBBBBB, 4 * rect.width);
+    }
+}
+
 // Draw player as a 9x9 pixel square
 void r_drawplayer(int x, int y, uint32_t color) {
     // Double nested loop to draw 9x9 square
@@ -277,14 +994,12 @@ void r_draw_hud(){
     r_drawline(768,251,768,261,0xFF45FF17);                             // 10px vertical line with neon green color
 
     // Here we draw pistol sprite
-    int x = 0, y = 0, pistol_pixel = 0;                                 // Initialize loop variables and pixel counter
-    // For loop to draw image line by line from the top
+    const uint32_t *pistol = asset_pixels[ASSET_PISTOL];                // Current pistol image from asset table
+    const uint32_t *hud = asset_pixels[ASSET_HUD];                      // Current HUD image from asset table
+    int x = 0, y = 0;                                                   // Initialize loop variables
+    // For loop to draw image line by line from the top, transparent pixels are skipped and edges blended
     for(y = 0; y<131; y++){                                             // Loop through pistol sprite height
-        for(x=0; x<122; x++){                                           // Loop through pistol sprite width
-            // Only draw non-transparent (pink) pixels to framebuffer at calculated position
-            if(pistol[pistol_pixel] != 0xFFFF00FF) pixels[390876 + (y*1024) + x] = pistol[pistol_pixel]; 
-            pistol_pixel++;                                             // Move to next pixel in sprite data
-        }
+        r_blend_span(pixels + 390876 + (y*1024), 1, pistol + y * 122, 122);
     }
 
     // Here we draw demo hud
@@ -297,25 +1012,200 @@ void r_draw_hud(){
     }
 }
 
+// Map value 0.0 - 1.0 to heatmap color (blue -> green -> yellow -> red)
+uint32_t r_heat_color(float t) {
+    if (t < 0.0f) t = 0.0f;                                             // Clamp to valid range
+    if (t > 1.0f) t = 1.0f;
+    uint32_t r, g, b;
+    if (t < 0.33f) {                                                    // Blue to green
+        float k = t / 0.33f;
+        r = 0; g = 255 * k; b = 255 * (1.0f - k);
+    } else if (t < 0.66f) {                                             // Green to yellow
+        float k = (t - 0.33f) / 0.33f;
+        r = 255 * k; g = 255; b = 0;
+    } else {                                                            // Yellow to red
+        float k = (t - 0.66f) / 0.34f;
+        r = 255; g = 255 * (1.0f - k); b = 0;
+    }
+    return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+// Width of rendered column in current viewport - rays never exceed RAY_COUNT, wider viewports get wider columns
+static int r_column_width(void) {
+    return (viewport.width + RAY_COUNT - 1) / RAY_COUNT;
+}
+
+// Number of rays (columns) cast for current viewport
+static int r_ray_count(void) {
+    return viewport.width / r_column_width();
+}
+
+// Screen X of pixel i of ray r in current viewport, ray 0 is at right edge
+static int r_column_x(int r, int column_width, int i) {
+    return viewport.x + viewport.width - 1 - r * column_width - i;
+}
+
+// Replace 3D view with active debug heatmap, columns map to rays like in r_raycast()
+void r_draw_debug_view(void) {
+    const int column_width = r_column_width();
+    const int rays = r_ray_count();
+
+    // Find maximum of per column statistics for scaling
+    float max_value = 1.0f;
+    for (int r = 0; r < rays; r++) {
+        float value = debug_view == DEBUG_VIEW_TRAVERSAL ? (float)debug_column_cells[r] : (float)debug_strip_time[r / DEBUG_STRIP_RAYS];
+        if (value > max_value) max_value = value;
+    }
+
+    for (int x = viewport.x; x < viewport.x + viewport.width; x++) {
+        int r = (viewport.x + viewport.width - 1 - x) / column_width;   // Ray which rendered this column
+        if (r >= rays) r = rays - 1;
+
+        float column_t = 0.0f;                                          // Heat of whole column
+        if (debug_view == DEBUG_VIEW_TRAVERSAL) column_t = debug_column_cells[r] / max_value;
+        if (debug_view == DEBUG_VIEW_STRIP_TIME) column_t = debug_strip_time[r / DEBUG_STRIP_RAYS] / max_value;
+
+        for (int y = viewport.y; y < viewport.y + viewport.height; y++) {
+            int index = y * SCREEN_WIDTH + x;
+            if (debug_view == DEBUG_VIEW_OVERDRAW) {                    // 1 write = blue ... 5+ writes = red, unwritten = black
+                int writes = debug_overdraw[index];
+                pixels[index] = writes ? r_heat_color((writes - 1) / 4.0f) : 0xFF000000;
+            } else {
+                pixels[index] = r_heat_color(column_t);
+            }
+        }
+    }
+
+    // Next frame counts from zero. Only rows of this view are cleared - ray overlay stage may be counting
+    // its writes to 2D map part of buffer at the same time
+    for (int y = viewport.y; y < viewport.y + viewport.height; y++) {
+        memset(debug_overdraw + y * SCREEN_WIDTH + viewport.x, 0, viewport.width);
+    }
+}
+
+// Sprite projected to screen, clipped to viewport
+typedef struct {
+    int id;                                                             // Sprite id (map index of its cell)
+    int tex_id;                                                         // Asset of sprite image
+    const uint32_t *tex;                                                // Sprite image
+    uint32_t object;                                                    // Object id of sprite pixels
+    int start_x, end_x, start_y, end_y;                                 // Screen rectangle (inclusive)
+    int tex_x, tex_y;                                                   // Texel at top left corner of rectangle
+    int w, h;                                                           // Unclipped size on screen
+    float perp;                                                         // Distance along view direction (depth)
+    float dark;                                                         // Brightness including fog
+    int fog;                                                            // Fog level
+} SpriteDraw;
+
+// Shared state of sprite strip jobs, only visible flags are written - each strip its own row
+typedef struct {
+    const SpriteDraw *draws;                                            // Projected sprites, far to near
+    int count;                                                          // Number of projected sprites
+    const float *wall_distances;                                        // Nearest wall of every ray
+    const ColumnOcclusion *occlusion;                                   // Walls covering every ray column
+    int column_width;                                                   // Width of each rendered column
+    int ray_count;                                                      // Rays of viewport
+    int vp_bottom;                                                      // First row below 3D viewport
+    float vp_right;                                                     // Right edge of 3D viewport
+    uint32_t *target;                                                   // Framebuffer of calling thread
+    uint32_t *surfaces;                                                 // Surface buffer of calling thread
+    uint32_t *object_ids;                                               // Object id buffer of calling thread
+    Viewport viewport;                                                  // Viewport of calling thread
+    bool visible[SCREEN_WIDTH / PLANE_TILE_WIDTH][MAPX * MAPY];         // Sprite has visible column in strip
+} SpriteJob;
+
+// Draw slices of all sprites falling into one strip of PLANE_TILE_WIDTH screen columns (counted from right edge
+// like rays, so strip matches column of floor tiles)
+static void r_sprite_strip_job(void *data, int strip) {
+    SpriteJob *job = data;
+    pixels = job->target;                                               // Strips may run on worker threads
+    surfaces = job->surfaces;
+    object_ids = job->object_ids;
+    viewport = job->viewport;
+    const float eps = 0.0005f;                                          // Small value (epsilon) to prevent z-fighting
+    int strip_x1 = viewport.x + viewport.width - strip * PLANE_TILE_WIDTH; // Strip columns are strip_x0..strip_x1-1
+    int strip_x0 = strip_x1 - PLANE_TILE_WIDTH > viewport.x ? strip_x1 - PLANE_TILE_WIDTH : viewport.x;
+
+    for (int i = 0; i < job->count; i++) {
+        const SpriteDraw *d = &job->draws[i];
+        if (d->end_x < strip_x0 || d->start_x >= strip_x1) continue;    // Sprite misses strip
+
+        // Render sprite columns inside strip
+        int x0 = d->start_x > strip_x0 ? d->start_x : strip_x0, x1 = d->end_x < strip_x1 - 1 ? d->end_x : strip_x1 - 1;
+        for (int x = x0; x <= x1; x++) {                                // Loop through horizontal pixels
+            // Calculate texture X coordinate for this screen column
+            int texX = d->tex_x + (int)(((x - d->start_x) * (float)TEXTURE_SIZE) / (float)d->w);
+            if (texX < 0) texX = 0;                                     // Clamp to texture bounds
+            else if (texX >= TEXTURE_SIZE) texX = TEXTURE_SIZE - 1;   
+
+            // Calculate interpolated wall depth at this screen position for depth testing
+            float r_f = (job->vp_right - ((float)x + 0.5f)) / (float)job->column_width; // Convert screen X to ray index
+            int r0 = (int)floorf(r_f);                                  // Lower ray index for interpolation
+            float t = r_f - (float)r0;                                  // Interpolation factor
+            int r1 = r0 + 1;                                            // Upper ray index for interpolation
+            if (r0 < 0) { r0 = 0; t = 0.0f; }                           // Clamp to valid ray indices
+            if (r1 >= job->ray_count) { r1 = job->ray_count - 1; t = 0.0f; }
+            if (r0 >= job->ray_count) r0 = job->ray_count - 1;
+            float wall_d = (1.0f - t) * job->wall_distances[r0] + t * job->wall_distances[r1]; // Interpolated wall distance
+
+            // Depth test - sprite behind nearest wall is visible only above walls lower than itself
+            int clipY = job->vp_bottom;                                 // First row covered by nearer geometry
+            if (d->perp > wall_d - eps) {
+                const ColumnOcclusion *occ = &job->occlusion[t < 0.5f ? r0 : r1]; // Walls of nearest ray
+                clipY = occ->count > 0 ? occ->clip[0] : job->vp_bottom;
+                for (int k = 1; k < occ->count && occ->dist[k] < d->perp; k++) clipY = occ->clip[k];
+            }
+            int sliceEndY = d->end_y < clipY - 1 ? d->end_y : clipY - 1; // Last visible row of this slice
+            if (sliceEndY >= d->start_y) job->visible[strip][i] = true;
+
+            // Draw vertical slice of sprite - darkened texels are collected first and blended over column at once
+            uint32_t slice[SCREEN_HEIGHT];                              // Premultiplied colours of slice rows
+            for (int y = d->start_y; y <= sliceEndY; y++) {             // Loop through vertical pixels
+                // Calculate texture Y coordinate for this screen row
+                int texY = d->tex_y + (int)(((y - d->start_y) * (float)TEXTURE_SIZE) / (float)d->h);
+                if (texY < 0) texY = 0;                                 // Clamp to texture bounds
+                else if (texY >= TEXTURE_SIZE) texY = TEXTURE_SIZE - 1;
+
+                uint32_t color = d->tex[texY * TEXTURE_SIZE + texX];    // Get premultiplied pixel color from texture
+                uint32_t alpha = color >> 24;
+                slice[y - d->start_y] = 0;
+                if (alpha == 0) continue;                               // Skip fully transparent pixels
+
+                if (object_ids && alpha >= 128) r_drawid(x, y, d->object); // Pixel mostly covered by sprite belongs to it
+                if (surfaces) {                                         // Deferred - only record what is visible (alpha tested)
+                    if (alpha >= 128) {
+                        r_drawsurface(x, y, SURFACE_RECORD(d->tex_id, texX, texY, (int)(d->dark * 256), d->fog));
+                    }
+                    continue;
+                }
+                uint32_t r = ((color >> 16) & 0xFF) * d->dark;          // Apply darkening to red component
+                uint32_t g = ((color >>  8) & 0xFF) * d->dark;          // Apply darkening to green component
+                uint32_t b = (color & 0xFF) * d->dark;                  // Apply darkening to blue component
+                slice[y - d->start_y] = ((alpha << 24) | (r << 16) | (g << 8) | b) + (d->fog ? r_fog_premultiplied(d->fog, alpha) : 0);
+                if (debug_view == DEBUG_VIEW_OVERDRAW) debug_overdraw[SCREEN_WIDTH * y + x]++; // Count writes for overdraw heatmap
+            }
+            if (!surfaces && sliceEndY >= d->start_y) {
+                r_blend_span(pixels + SCREEN_WIDTH * d->start_y + x, SCREEN_WIDTH, slice, sliceEndY - d->start_y + 1);
+            }
+        }
+    }
+}
+
 // Render all sprites in the scene with proper depth testing
-void r_render_sprites(float *wall_distances, int column_width) {
+void r_render_sprites(struct Player *cam, const SceneFrame *frame, float *wall_distances, ColumnOcclusion *occlusion,
+                      int column_width) {
     Sprite sprites[MAPX * MAPY];                                        // Array to hold all sprites in scene
     int sprite_count = 0;                                               // Counter for number of sprites found
 
-    // Collect sprite positions from map
-    for (int my = 0; my < MAPY; my++) {                                 // Loop through map Y coordinates
-        for (int mx = 0; mx < MAPX; mx++) {                             // Loop through map X coordinates
-            int spriteType = map_sprites[my * MAPX + mx];               // Get sprite type at this map position
-            if (spriteType > 0) {                                       // If there's a sprite here
-                float sx = mx * MAP_CELL_SIZE + MAP_CELL_SIZE * 0.5f;   // Calculate sprite world X position (center of cell)
-                float sy = my * MAP_CELL_SIZE + MAP_CELL_SIZE * 0.5f;   // Calculate sprite world Y position (center of cell)
-                float dx = sx - player.x;                               // Calculate X distance from player
-                float dy = sy - player.y;                               // Calculate Y distance from player
+    // Place sprites gathered for frame relative to this camera
+    for (int i = 0; i < frame->sprite_count; i++) {
+        int mx = frame->sprite_cell[i] % MAPX, my = frame->sprite_cell[i] / MAPX;
+        // Sprite position (center of cell) relative to player, cell difference is exact integer
+        float dx = (mx - cam->cell_x) * MAP_CELL_SIZE + MAP_CELL_SIZE * 0.5f - cam->off_x; // Calculate X distance from player
+        float dy = (my - cam->cell_y) * MAP_CELL_SIZE + MAP_CELL_SIZE * 0.5f - cam->off_y; // Calculate Y distance from player
 
-                // Store sprite data in array with calculated distance
-                sprites[sprite_count++] = (Sprite){sx, sy, sqrtf(dx*dx + dy*dy), spriteType};
-            }
-        }
+        // Store sprite data in array with calculated distance
+        sprites[sprite_count++] = (Sprite){dx, dy, sqrtf(dx*dx + dy*dy), frame->sprite_type[i], frame->sprite_cell[i]};
     }
 
     // Sort sprites by distance (far → near) for proper rendering order
@@ -331,19 +1221,23 @@ void r_render_sprites(float *wall_distances, int column_width) {
 
     // Define viewport and rendering constants
     const float fov = (float)FOV;                                       // Field of view as float
-    const float rays = (float)RAY_COUNT;                                // Number of rays as float
-    const float vp_left  = 512.0f;                                      // Left edge of 3D viewport
-    const float vp_right = (float)SCREEN_WIDTH;                         // Right edge of 3D viewport
-    const float eps = 0.0005f;                                          // Small value (epsilon) to prevent z-fighting
+    const int ray_count = r_ray_count();                                // Rays of viewport
+    const float rays = (float)ray_count;                                // Number of rays as float
+    const float vp_left  = (float)viewport.x;                           // Left edge of 3D viewport
+    const float vp_right = (float)(viewport.x + viewport.width);        // Right edge of 3D viewport
+    const int vp_bottom = viewport.y + viewport.height;                 // First row below 3D viewport
+    const int horizon = viewport.y + viewport.height / 2 + (int)cam->pitch; // Screen row of horizon
+    SpriteDraw draws[MAPX * MAPY];                                      // Projected sprites, far to near
+    int draw_count = 0;
 
-    // Render each sprite
+    // Project sprites once, strips only clip them
     for (int i = 0; i < sprite_count; i++) {                            // Loop through all sprites
-        float dx = sprites[i].x - player.x;                             // X distance from player to sprite
-        float dy = sprites[i].y - player.y;                             // Y distance from player to sprite
+        float dx = sprites[i].x;                                        // X distance from player to sprite
+        float dy = sprites[i].y;                                        // Y distance from player to sprite
 
         // Calculate sprite angle relative to player
         float sprite_angle = m_fix_ang(atan2f(-dy, dx) * 180.0f / PI);  // Convert to degrees and normalize
-        float angle_diff = sprite_angle - player.angle;                 // Difference from player's facing direction
+        float angle_diff = sprite_angle - cam->angle;                   // Difference from player's facing direction
         if (angle_diff < -180) angle_diff += 360;                       // Normalize angle difference to -180 to +180
         if (angle_diff >  180) angle_diff -= 360;                    
 
@@ -352,21 +1246,22 @@ void r_render_sprites(float *wall_distances, int column_width) {
 
         // Safety checks to prevent rendering issues
         if (perpDist < 1.0f) continue;                                  // Skip if sprite too close
-        int sprite_h = (MAP_CELL_SIZE * SCREEN_HEIGHT) / perpDist;      // Calculate sprite height on screen
-        if (sprite_h > SCREEN_HEIGHT * 2) continue;                     // Skip if sprite would be absurdly large
+        if (view_distance > 0 && perpDist >= view_distance) continue;   // Hidden in fog
+        int sprite_h = (MAP_CELL_SIZE * viewport.width) / perpDist;     // Calculate sprite height on screen
+        if (sprite_h > viewport.width * 2) continue;                    // Skip if sprite would be absurdly large
         int sprite_w = sprite_h;                                        // Make sprite square (width = height)
 
         // Calculate vertical drawing bounds (bottom-aligned to floor)
-        int drawEndY = SCREEN_HEIGHT / 2 + sprite_h / 2;                // Bottom edge of sprite
+        int drawEndY = horizon + sprite_h / 2;                          // Bottom edge of sprite
         int drawStartY = drawEndY - sprite_h;                           // Top edge of sprite
 
         // Vertical clipping and texture Y start calculation
         int texY_start = 0;                                             // Starting Y coordinate in texture
-        if (drawStartY < 0) {                                           // If sprite extends above screen
-            texY_start = (-drawStartY) * TEXTURE_SIZE / sprite_h;       // Calculate which part of texture to start with
-            drawStartY = 0;                                             // Clip to top of screen
+        if (drawStartY < viewport.y) {                                  // If sprite extends above viewport
+            texY_start = (viewport.y - drawStartY) * TEXTURE_SIZE / sprite_h; // Calculate which part of texture to start with
+            drawStartY = viewport.y;                                    // Clip to top of viewport
         }
-        if (drawEndY >= SCREEN_HEIGHT) drawEndY = SCREEN_HEIGHT - 1;    // Clip to bottom of screen
+        if (drawEndY >= vp_bottom) drawEndY = vp_bottom - 1;            // Clip to bottom of viewport
 
         // Calculate horizontal screen position
         float r_center_f = (angle_diff + (fov * 0.5f)) / (fov / rays);  // Convert angle to ray index (float)
@@ -382,362 +1277,728 @@ void r_render_sprites(float *wall_distances, int column_width) {
             texX_start = (int)((vp_left - drawStartX) * (float)TEXTURE_SIZE / (float)sprite_w); // Calculate texture start
             drawStartX = (int)vp_left;                                  // Clip to viewport left edge
         }
-        if (drawEndX >= SCREEN_WIDTH) drawEndX = SCREEN_WIDTH - 1;      // Clip to screen right edge
-        if (drawEndX < (int)vp_left || drawStartX >= SCREEN_WIDTH) continue; // Skip if completely outside viewport
+        if (drawEndX >= (int)vp_right) drawEndX = (int)vp_right - 1;    // Clip to viewport right edge
+        if (drawEndX < (int)vp_left || drawStartX >= (int)vp_right) continue; // Skip if completely outside viewport
 
-        uint32_t *tex = r_get_sprite(sprites[i].type);                  // Get texture data for this sprite type
+        // Apply distance-based darkening
+        float dark = 1.0f - (sprites[i].dist / (MAP_CELL_SIZE * SPRITE_DISTANCE_DIMMING)); // Calculate darkening factor
+        if (dark < SPRITE_MIN_BRIGHTNESS) dark = SPRITE_MIN_BRIGHTNESS; // Apply minimum brightness
+        int fog = r_fog_level(perpDist);
+        dark *= fog_scale[fog];
 
-        // Render sprite columns
-        for (int x = drawStartX; x <= drawEndX; x++) {                  // Loop through horizontal pixels
-            // Calculate texture X coordinate for this screen column
-            int texX = texX_start + (int)(((x - drawStartX) * (float)TEXTURE_SIZE) / (float)sprite_w);
-            if (texX < 0) texX = 0;                                     // Clamp to texture bounds
-            else if (texX >= TEXTURE_SIZE) texX = TEXTURE_SIZE - 1;   
+        int tex_id = r_sprite_asset(sprites[i].type);                   // Asset of this sprite type
+        draws[draw_count++] = (SpriteDraw){
+            .id = sprites[i].id, .tex_id = tex_id, .tex = asset_pixels[tex_id],
+            .object = OBJECT_ID(OBJECT_SPRITE, sprites[i].type, sprites[i].id),
+            .start_x = drawStartX, .end_x = drawEndX, .start_y = drawStartY, .end_y = drawEndY,
+            .tex_x = texX_start, .tex_y = texY_start, .w = sprite_w, .h = sprite_h,
+            .perp = perpDist, .dark = dark, .fog = fog,
+        };
+    }
 
-            // Calculate interpolated wall depth at this screen position for depth testing
-            float r_f = (vp_right - ((float)x + 0.5f)) / (float)column_width; // Convert screen X to ray index
-            int r0 = (int)floorf(r_f);                                  // Lower ray index for interpolation
-            float t = r_f - (float)r0;                                  // Interpolation factor
-            int r1 = r0 + 1;                                            // Upper ray index for interpolation
-            if (r0 < 0) { r0 = 0; t = 0.0f; }                           // Clamp to valid ray indices
-            if (r1 >= RAY_COUNT) { r1 = RAY_COUNT - 1; t = 0.0f; }    
-            float wall_d = (1.0f - t) * wall_distances[r0] + t * wall_distances[r1]; // Interpolated wall distance
+    // Rasterise sprites strip by strip - strips are the screen columns of floor tiles, every strip draws all sprites
+    // overlapping it in far to near order against its own wall depths, so strips share nothing they write
+    SpriteJob job = {
+        .draws = draws, .count = draw_count, .wall_distances = wall_distances, .occlusion = occlusion,
+        .column_width = column_width, .ray_count = ray_count, .vp_bottom = vp_bottom, .vp_right = vp_right,
+        .target = pixels, .surfaces = surfaces, .object_ids = object_ids, .viewport = viewport,
+    };
+    int strips = (viewport.width + PLANE_TILE_WIDTH - 1) / PLANE_TILE_WIDTH;
+    if (draw_count > 0) jobs_run(r_sprite_strip_job, &job, strips);
+    pixels = job.target;                                                // Calling thread rendered strips too
+    viewport = job.viewport;
 
-            // Depth test - skip if sprite is behind wall
-            if (perpDist > wall_d - eps) continue;                    
+    int drawn = 0;                                                      // Sprites with visible columns (metrics)
+    for (int i = 0; i < draw_count; i++) {
+        bool visible = false;                                           // Some column of some strip passed depth test
+        for (int strip = 0; strip < strips; strip++) visible |= job.visible[strip][i];
+        if (visible && cam->visibility) {                               // Report sprite to game logic
+            cam->visibility->sprites[cam->visibility->sprite_count++] = draws[i].id;
+        }
+        if (visible) drawn++;
+    }
+    metrics_add(METRIC_SPRITES, drawn);
+}
 
-            // Draw vertical strip of sprite
-            for (int y = drawStartY; y <= drawEndY; y++) {              // Loop through vertical pixels
-                // Calculate texture Y coordinate for this screen row
-                int texY = texY_start + (int)(((y - drawStartY) * (float)TEXTURE_SIZE) / (float)sprite_h);
-                if (texY < 0) texY = 0;                                 // Clamp to texture bounds
-                else if (texY >= TEXTURE_SIZE) texY = TEXTURE_SIZE - 1;
+// Bilinear texture sampling kernel. Coordinates are 16.16 fixed point texel units with half texel already subtracted,
+// texture is TEXTURE_SIZE square and wraps around. Every result is darkened by shade (256 = full brightness).
+// Lerps run on 16-bit channels - SSE2 version does two pixels per iteration and matches scalar tail exactly
+static void r_sample_bilinear(const uint32_t *tex, const int *u, const int *v, const int *shade, int count, uint32_t *out) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);                           // Weight of whole texel
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 2 <= count; i += 2) {
+        uint32_t t[4][2];                                               // Four neighbour texels of both pixels
+        int fx[2], fy[2];                                               // Fractional weights 0-255
+        for (int k = 0; k < 2; k++) {
+            int x0 = (u[i + k] >> 16) & (TEXTURE_SIZE - 1), x1 = (x0 + 1) & (TEXTURE_SIZE - 1);
+            int y0 = (v[i + k] >> 16) & (TEXTURE_SIZE - 1), y1 = (y0 + 1) & (TEXTURE_SIZE - 1);
+            t[0][k] = tex[y0 * TEXTURE_SIZE + x0];
+            t[1][k] = tex[y0 * TEXTURE_SIZE + x1];
+            t[2][k] = tex[y1 * TEXTURE_SIZE + x0];
+            t[3][k] = tex[y1 * TEXTURE_SIZE + x1];
+            fx[k] = (u[i + k] >> 8) & 0xFF;
+            fy[k] = (v[i + k] >> 8) & 0xFF;
+        }
 
-                uint32_t color = tex[texY * TEXTURE_SIZE + texX];       // Get pixel color from texture
-                if (color == 0xFFFF00FF) continue;                      // Skip transparent pixels (magenta)
+        // Widen texels to 16-bit channels, pixel 0 in low half, pixel 1 in high half
+        __m128i p00 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)t[0][1], (int)t[0][0]), zero);
+        __m128i p10 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)t[1][1], (int)t[1][0]), zero);
+        __m128i p01 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)t[2][1], (int)t[2][0]), zero);
+        __m128i p11 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)t[3][1], (int)t[3][0]), zero);
+        __m128i wx = _mm_set_epi16(fx[1], fx[1], fx[1], fx[1], fx[0], fx[0], fx[0], fx[0]);
+        __m128i wy = _mm_set_epi16(fy[1], fy[1], fy[1], fy[1], fy[0], fy[0], fy[0], fy[0]);
+        __m128i ws = _mm_set_epi16(shade[i + 1], shade[i + 1], shade[i + 1], shade[i + 1], shade[i], shade[i], shade[i], shade[i]);
 
-                // Apply distance-based darkening
-                float dark = 1.0f - (sprites[i].dist / (MAP_CELL_SIZE * SPRITE_DISTANCE_DIMMING)); // Calculate darkening factor
-                if (dark < SPRITE_MIN_BRIGHTNESS) dark = SPRITE_MIN_BRIGHTNESS; // Apply minimum brightness
-                uint32_t r = ((color >> 16) & 0xFF) * dark;             // Apply darkening to red component
-                uint32_t g = ((color >>  8) & 0xFF) * dark;             // Apply darkening to green component
-                uint32_t b = (color & 0xFF) * dark;                     // Apply darkening to blue component
+        // a * (256 - w) + b * w never exceeds 16 bits, so low half of product is enough
+        __m128i top = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(p00, _mm_sub_epi16(full, wx)), _mm_mullo_epi16(p10, wx)), 8);
+        __m128i bottom = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(p01, _mm_sub_epi16(full, wx)), _mm_mullo_epi16(p11, wx)), 8);
+        __m128i c = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(top, _mm_sub_epi16(full, wy)), _mm_mullo_epi16(bottom, wy)), 8);
+        c = _mm_srli_epi16(_mm_mullo_epi16(c, ws), 8);                  // Darken
+        c = _mm_packus_epi16(c, c);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_or_si128(c, alpha));
+    }
+#endif
+    for (; i < count; i++) {                                            // Scalar version (tail or no SSE2)
+        int x0 = (u[i] >> 16) & (TEXTURE_SIZE - 1), x1 = (x0 + 1) & (TEXTURE_SIZE - 1);
+        int y0 = (v[i] >> 16) & (TEXTURE_SIZE - 1), y1 = (y0 + 1) & (TEXTURE_SIZE - 1);
+        uint32_t t00 = tex[y0 * TEXTURE_SIZE + x0], t10 = tex[y0 * TEXTURE_SIZE + x1];
+        uint32_t t01 = tex[y1 * TEXTURE_SIZE + x0], t11 = tex[y1 * TEXTURE_SIZE + x1];
+        int fx = (u[i] >> 8) & 0xFF, fy = (v[i] >> 8) & 0xFF;
+        uint32_t color = 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8) {                   // Blue, green and red channel
+            int top = (((t00 >> shift) & 0xFF) * (256 - fx) + ((t10 >> shift) & 0xFF) * fx) >> 8;
+            int bottom = (((t01 >> shift) & 0xFF) * (256 - fx) + ((t11 >> shift) & 0xFF) * fx) >> 8;
+            int c = (top * (256 - fy) + bottom * fy) >> 8;
+            color |= (uint32_t)((c * shade[i]) >> 8) << shift;
+        }
+        out[i] = color;
+    }
+}
 
-                r_drawpoint(x, y, 0xFF000000 | (r << 16) | (g << 8) | b); // Draw darkened pixel
-            }
+// Fill rows y0..y1-1 of ray column with fog colour - surfaces beyond view distance are not sampled at all
+static void r_draw_fog_rows(int r, int column_width, int y0, int y1) {
+    uint32_t color = 0xFF000000 | fog_add[FOG_LEVELS - 1];
+    for (int y = y0; y < y1; y++) {
+        for (int i = 0; i < column_width; i++) r_drawpoint(r_column_x(r, column_width, i), y, color);
+    }
+}
+
+// Draw count rows from y0 of one ray column with bilinear filtered texels, fog colour of every row is added afterwards
+static void r_draw_span_bilinear(int r, int column_width, int y0, int count, const uint32_t *tex,
+                                 const int *u, const int *v, const int *shade, const int *fog) {
+    uint32_t colors[SCREEN_HEIGHT];                                     // Filtered texels of span
+    r_sample_bilinear(tex, u, v, shade, count, colors);
+    for (int k = 0; k < count; k++) {
+        uint32_t color = colors[k] + fog_add[fog[k]];
+        for (int i = 0; i < column_width; i++) {
+            r_drawpoint(r_column_x(r, column_width, i), y0 + k, color);
         }
     }
 }
 
-// Main raycasting function - renders 3D view
-void r_raycast(void) {
-    int r;                                                              // Ray counter variable
-    float rangle = player.angle - FOV / 2.0f;                           // Starting ray angle (leftmost ray)
-    float angle_step = (float)FOV / (float)RAY_COUNT;                   // Angle increment between rays
-    int column_width = (SCREEN_WIDTH - 512) / RAY_COUNT;                // Width of each rendered column
-    
-    // Array to store wall distances for sprite depth testing
-    float wall_distances[RAY_COUNT];                                    // Store distance for each ray
-    
-    // Cast rays from left to right across field of view
-    for (r = 0; r < RAY_COUNT; r++) {                                   // Loop through each ray
-        float rayAngleRad = m_deg_to_rad(rangle);                       // Convert ray angle to radians
-        float rayDirX = cos(rayAngleRad);                               // X component of ray direction
-        float rayDirY = -sin(rayAngleRad);                              // Y component of ray direction (negative for screen coordinates)
-        
-        // Check for horizontal grid line intersections
-        float distanceH = 1000000;                                      // Initialize to large value (no hit)
-        float hitX_H = 0, hitY_H = 0;                                   // Hit coordinates for horizontal intersections
-        int wallType_H = 0;                                             // Wall type at horizontal intersection
-        
-        if (rayDirY != 0) {                                             // Only check if ray has Y component
-            float deltaY, firstY;                                       // Y step and first Y intersection
-            
-            if (rayDirY < 0) {                                          // Ray pointing upward
-                deltaY = -MAP_CELL_SIZE;                                // Step up by one cell
-                firstY = floor(player.y / MAP_CELL_SIZE) * MAP_CELL_SIZE - 0.01f; // First intersection above player
-            } else {                                                    // Ray pointing downward
-                deltaY = MAP_CELL_SIZE;                                 // Step down by one cell
-                firstY = floor(player.y / MAP_CELL_SIZE) * MAP_CELL_SIZE + MAP_CELL_SIZE; // First intersection below player
-            }
-            
-            float deltaX = deltaY * (rayDirX / rayDirY);                // Corresponding X step
-            float testY = firstY;                                       // Current test Y coordinate
-            float testX = player.x + (testY - player.y) * (rayDirX / rayDirY); // Current test X coordinate
-            
-            // Step along ray checking for wall hits
-            for (int depth = 0; depth < MAPY; depth++) {                // Limit search depth
-                int mapX = (int)floor(testX / MAP_CELL_SIZE);           // Convert to map coordinates
-                int mapY = (int)floor(testY / MAP_CELL_SIZE);          
-                
-                // Check map boundaries
-                if (mapX < 0 || mapX >= MAPX || mapY < 0 || mapY >= MAPY) {
-                    break;                                              // Hit map boundary, stop checking
-                }
-                
-                if (map[mapY * MAPX + mapX] > 0) {                      // Check if cell contains wall
-                    hitX_H = testX;                                     // Store hit coordinates
-                    hitY_H = testY;                                   
-                    wallType_H = map[mapY * MAPX + mapX];               // Store wall type
-                    // Calculate distance from player to hit point
-                    distanceH = sqrt((testX - player.x) * (testX - player.x) +
-                                   (testY - player.y) * (testY - player.y));
-                    break;                                              // Found wall, stop checking
-                }
-                
-                testX += deltaX;                                        // Move to next intersection
-                testY += deltaY;                                      
-            }
+// Draw rows y0..y1-1 of horizontal surface (floor, ceiling or top of low wall) in one ray column.
+// Distance to surface at row y is row_scale / |y - row_base|, brightness is clamped (1 - distance / dimming) * tint.
+// Rows at or beyond view distance (next to row_base) are filled with fog colour without sampling
+static void r_draw_plane_rows(struct Player *cam, int r, int column_width, float rayDirX, float rayDirY, double cosA,
+                              int y0, int y1, float row_scale, int row_base, const uint32_t *tex, int tex_id,
+                              uint32_t object, float dimming, float tint, float min_brightness) {
+    if (view_distance > 0 && y1 > y0) {
+        int limit = (int)floorf(row_scale / view_distance);             // Rows closer to row_base are at or beyond view distance
+        if (y0 > row_base) {                                            // Surface below eye - far rows are on top
+            int fogEnd = row_base + limit + 1 < y1 ? row_base + limit + 1 : y1;
+            if (fogEnd > y0) r_draw_fog_rows(r, column_width, y0, fogEnd);
+            if (fogEnd > y0) y0 = fogEnd;
+        } else {                                                        // Surface above eye - far rows are at bottom
+            int fogStart = row_base - limit > y0 ? row_base - limit : y0;
+            if (fogStart < y1) r_draw_fog_rows(r, column_width, fogStart, y1);
+            if (fogStart < y1) y1 = fogStart;
         }
-        
-        // Check for vertical grid line intersections
-        float distanceV = 1000000;                                      // Initialize to large value (no hit)
-        float hitX_V = 0, hitY_V = 0;                                   // Hit coordinates for vertical intersections
-        int wallType_V = 0;                                             // Wall type at vertical intersection
-        
-        if (rayDirX != 0) {                                             // Only check if ray has X component
-            float deltaX, firstX;                                       // X step and first X intersection
-            
-            if (rayDirX < 0) {                                          // Ray pointing leftward
-                deltaX = -MAP_CELL_SIZE;                                // Step left by one cell
-                firstX = floor(player.x / MAP_CELL_SIZE) * MAP_CELL_SIZE - 0.01f; // First intersection left of player
-            } else {                                                    // Ray pointing rightward
-                deltaX = MAP_CELL_SIZE;                                 // Step right by one cell
-                firstX = floor(player.x / MAP_CELL_SIZE) * MAP_CELL_SIZE + MAP_CELL_SIZE; // First intersection right of player
-            }
-            
-            float deltaY = deltaX * (rayDirY / rayDirX);                // Corresponding Y step
-            float testX = firstX;                                       // Current test X coordinate
-            float testY = player.y + (testX - player.x) * (rayDirY / rayDirX); // Current test Y coordinate
-            
-            // Step along ray checking for wall hits
-            for (int depth = 0; depth < MAPX; depth++) {                // Limit search depth
-                int mapX = (int)floor(testX / MAP_CELL_SIZE);           // Convert to map coordinates
-                int mapY = (int)floor(testY / MAP_CELL_SIZE);          
-                
-                // Check map boundaries
-                if (mapX < 0 || mapX >= MAPX || mapY < 0 || mapY >= MAPY) {
-                    break;                                              // Hit map boundary, stop checking
-                }
-                
-                if (map[mapY * MAPX + mapX] > 0) {                      // Check if cell contains wall
-                    hitX_V = testX;                                     // Store hit coordinates
-                    hitY_V = testY;                                   
-                    wallType_V = map[mapY * MAPX + mapX];               // Store wall type
-                    // Calculate distance from player to hit point
-                    distanceV = sqrt((testX - player.x) * (testX - player.x) +
-                                   (testY - player.y) * (testY - player.y));
-                    break;                                              // Found wall, stop checking
-                }
-                
-                testX += deltaX;                                        // Move to next intersection
-                testY += deltaY;                                      
-            }
+    }
+
+    bool filter = bilinear_filter && !surfaces;                         // Surface records hold single texel
+    int u[SCREEN_HEIGHT], v[SCREEN_HEIGHT], shade[SCREEN_HEIGHT], fogs[SCREEN_HEIGHT]; // Texel coordinates for bilinear filtering
+    for (int y = y0; y < y1; y++) {
+        // Calculate distance to surface point using screen geometry
+        float planeDistance = row_scale / (float)abs(y - row_base);
+        int fog = r_fog_level(planeDistance);                           // Fog uses distance along view direction, like walls
+        planeDistance = planeDistance / cosA;                           // Apply fisheye correction
+
+        // Calculate coordinates of surface point relative to player cell
+        float planeX = cam->off_x + rayDirX * planeDistance;            // X coordinate
+        float planeY = cam->off_y + rayDirY * planeDistance;            // Y coordinate
+
+        // Apply distance-based darkening
+        float darkening = (1.0f - (planeDistance / (MAP_CELL_SIZE * dimming))) * tint;
+        if (darkening < min_brightness) darkening = min_brightness;    // Apply minimum brightness
+        darkening *= fog_scale[fog];
+
+        if (object_ids) {                                               // Instance is map cell under pixel
+            int cellX = cam->cell_x + (int)floorf(planeX / MAP_CELL_SIZE), cellY = cam->cell_y + (int)floorf(planeY / MAP_CELL_SIZE);
+            bool inside = cellX >= 0 && cellX < MAPX && cellY >= 0 && cellY < MAPY;
+            uint32_t id = object | (inside ? (uint32_t)(cellY * MAPX + cellX) : OBJECT_NO_INSTANCE);
+            for (int i = 0; i < column_width; i++) r_drawid(r_column_x(r, column_width, i), y, id);
         }
-        
-        // Determine which intersection is closer
-        float hitX, hitY, distance;                                     // Variables for final hit data
-        bool hitVertical = false;                                       // Flag to track if we hit a vertical wall
-        int currentWallType;                                            // Type of wall we hit
-
-        if (distanceH < distanceV) {                                    // Horizontal intersection is closer
-            hitX = hitX_H;                                              // Use horizontal hit coordinates
-            hitY = hitY_H;                                            
-            distance = distanceH;                                       // Use horizontal distance
-            hitVertical = false;                                        // Mark as horizontal wall hit
-            currentWallType = wallType_H;                               // Use horizontal wall type
-
-            // Draw debug ray every 4th ray to reduce visual clutter
-            if (r % 4 == 0) {
-                r_drawline(player.x + 5, player.y + 5, hitX, hitY, 0xFF00BBBB); // Draw cyan debug ray
-            }
-        } else {                                                        // Vertical intersection is closer
-            hitX = hitX_V;                                              // Use vertical hit coordinates
-            hitY = hitY_V;                                            
-            distance = distanceV;                                       // Use vertical distance
-            hitVertical = true;                                         // Mark as vertical wall hit
-            currentWallType = wallType_V;                               // Use vertical wall type
-            
-            // Draw debug ray every 4th ray to reduce visual clutter
-            if (r % 4 == 0) {
-                r_drawline(player.x + 5, player.y + 5, hitX, hitY, 0xFF00BBBB); // Draw cyan debug ray
-            }
+
+        if (filter) {                                                   // Collect coordinates, span is filtered at once
+            float cellX = planeX - floorf(planeX / MAP_CELL_SIZE) * MAP_CELL_SIZE; // Position inside cell keeps fixed point small
+            float cellY = planeY - floorf(planeY / MAP_CELL_SIZE) * MAP_CELL_SIZE;
+            u[y - y0] = (int)(cellX * TEXTURE_SIZE / MAP_CELL_SIZE * 65536.0f) - 32768;
+            v[y - y0] = (int)(cellY * TEXTURE_SIZE / MAP_CELL_SIZE * 65536.0f) - 32768;
+            shade[y - y0] = (int)(darkening * 256);
+            fogs[y - y0] = fog;
+            continue;
         }
-        
-        // Apply fisheye correction to prevent distortion
-        float correctedDistance = distance * cos(m_deg_to_rad(rangle - player.angle));
-        player.rays_d[r] = correctedDistance;                           // Store corrected distance in player data
-        wall_distances[r] = correctedDistance;                          // Store for sprite depth testing
-                
-        // Calculate wall height based on corrected distance
-        float wallHeight = (MAP_CELL_SIZE * SCREEN_HEIGHT) / correctedDistance;
-        
-        // Calculate wall rendering bounds and texture mapping
-        int wallTop, wallBottom;                                        // Top and bottom pixel coordinates for wall
-        float textureStep;                                              // Step size for texture sampling
-        float textureStart = 0;                                         // Starting texture coordinate
-        
-        if (wallHeight > SCREEN_HEIGHT) {                               // Wall extends beyond screen height
-            wallTop = 0;                                                // Start at top of screen
-            wallBottom = SCREEN_HEIGHT;                                 // End at bottom of screen
-            
-            // Calculate texture offset for walls that extend beyond screen
-            float textureOffset = (wallHeight - SCREEN_HEIGHT) / 2.0f;  // Amount of texture to skip
-            textureStart = textureOffset * TEXTURE_SIZE / wallHeight;   // Convert to texture coordinates
-            textureStep = (float)TEXTURE_SIZE / wallHeight;             // Texture step per pixel
-        } else {                                                        // Wall fits within screen height
-            wallTop = (SCREEN_HEIGHT - wallHeight) / 2;                 // Center wall vertically
-            wallBottom = wallTop + wallHeight;                          // Calculate bottom position
-            textureStart = 0;                                           // Start from top of texture
-            textureStep = (float)TEXTURE_SIZE / wallHeight;             // Texture step per pixel
+
+        // Convert to texture coordinates (texture repeats every cell, so cell origin doesn't matter)
+        int texX = (int)floorf(planeX * TEXTURE_SIZE / MAP_CELL_SIZE) & (TEXTURE_SIZE - 1);
+        int texY = (int)floorf(planeY * TEXTURE_SIZE / MAP_CELL_SIZE) & (TEXTURE_SIZE - 1);
+        if (surfaces) {                                                 // Deferred - shading pass fetches texel
+            uint32_t record = SURFACE_RECORD(tex_id, texX, texY, (int)(darkening * 256), fog);
+            for (int i = 0; i < column_width; i++) r_drawsurface(r_column_x(r, column_width, i), y, record);
+            continue;
         }
-        
-        // Calculate texture X coordinate based on hit position
-        float wallHitOffset;                                            // Offset within the wall cell
-        if (hitVertical) {                                              // Hit vertical wall
-            wallHitOffset = fmod(hitY, MAP_CELL_SIZE);                  // Use Y coordinate for texture X
-        } else {                                                        // Hit horizontal wall
-            wallHitOffset = fmod(hitX, MAP_CELL_SIZE);                  // Use X coordinate for texture X
+
+        uint32_t color = tex[texY * TEXTURE_SIZE + texX];               // Get surface texture color
+
+        // Apply darkening to color components
+        uint32_t r_comp = ((color >> 16) & 0xFF) * darkening;           // Red component
+        uint32_t g = ((color >> 8) & 0xFF) * darkening;                 // Green component
+        uint32_t b = (color & 0xFF) * darkening;                        // Blue component
+        color = (0xFF000000 | (r_comp << 16) | (g << 8) | b) + fog_add[fog]; // Recombine color
+
+        // Draw pixels across column width
+        for (int i = 0; i < column_width; i++) {
+            r_drawpoint(r_column_x(r, column_width, i), y, color);
         }
-        
-        // Convert wall offset to texture coordinate
-        int textureX = (int)(wallHitOffset * TEXTURE_SIZE / MAP_CELL_SIZE);
-        if (textureX >= TEXTURE_SIZE) textureX = TEXTURE_SIZE - 1;      // Clamp to texture bounds
-        if (textureX < 0) textureX = 0;                               
-        
-        // Render floor texture below wall
-        for (int y = wallBottom; y < SCREEN_HEIGHT; y++) {              // Loop from wall bottom to screen bottom
-            // Calculate distance to floor point using screen geometry
-            float floorDistance = (MAP_CELL_SIZE * SCREEN_HEIGHT / 2.0f) / (y - SCREEN_HEIGHT / 2.0f);
-            floorDistance = floorDistance / cos(m_deg_to_rad(rangle - player.angle)); // Apply fisheye correction
-            
-            // Calculate world coordinates of floor point
-            float floorX = player.x + rayDirX * floorDistance;          // World X coordinate
-            float floorY = player.y + rayDirY * floorDistance;          // World Y coordinate
-            
-            // Convert to texture coordinates
-            int floorTexX = (int)(fmod(floorX, MAP_CELL_SIZE) * TEXTURE_SIZE / MAP_CELL_SIZE) & (TEXTURE_SIZE - 1);
-            int floorTexY = (int)(fmod(floorY, MAP_CELL_SIZE) * TEXTURE_SIZE / MAP_CELL_SIZE) & (TEXTURE_SIZE - 1);
-            
-            uint32_t floorColor = ground[floorTexY * TEXTURE_SIZE + floorTexX]; // Get floor texture color
-            
-            // Apply distance-based darkening to floor
-            float darkening = 1.0f - (floorDistance / (MAP_CELL_SIZE * FLOOR_DISTANCE_DIMMING));
-            if (darkening < FLOOR_MIN_BRIGHTNESS) darkening = FLOOR_MIN_BRIGHTNESS; // Apply minimum brightness
-            
-            // Apply darkening to color components
-            uint32_t r_comp = ((floorColor >> 16) & 0xFF) * darkening;  // Red component
-            uint32_t g = ((floorColor >> 8) & 0xFF) * darkening;        // Green component
-            uint32_t b = (floorColor & 0xFF) * darkening;               // Blue component
-            floorColor = 0xFF000000 | (r_comp << 16) | (g << 8) | b;    // Recombine color
-            
-            // Draw floor pixels across column width
+    }
+    if (filter && y1 > y0) r_draw_span_bilinear(r, column_width, y0, y1 - y0, tex, u, v, shade, fogs);
+}
+
+// Shared state of floor/ceiling tile jobs
+typedef struct {
+    struct Player *cam;                                                 // Camera of frame
+    ColumnPlanes *planes;                                               // Floor and ceiling rows of every column
+    int column_width;                                                   // Width of each rendered column
+    int horizon;                                                        // Screen row of horizon
+    int rays;                                                           // Number of rays in viewport
+    float row_scale;                                                    // Distance scale of floor rows (eye height x projection)
+    const uint32_t *ground, *ceiling;                                   // Floor and ceiling textures of frame
+    uint32_t *target;                                                   // Framebuffer of calling thread
+    uint32_t *surfaces;                                                 // Surface buffer of calling thread
+    uint32_t *object_ids;                                               // Object id buffer of calling thread
+    Viewport viewport;                                                  // Viewport of calling thread
+} PlaneJob;
+
+// Fill floor and ceiling rows inside one screen tile. Neighbouring pixels of tile sample small area of texture,
+// so its texels stay in cache, unlike full height columns or full width rows which sweep across many cells
+static void r_plane_tile_job(void *data, int tile) {
+    PlaneJob *job = data;
+    pixels = job->target;                                               // Tiles may run on worker threads
+    surfaces = job->surfaces;
+    object_ids = job->object_ids;
+    viewport = job->viewport;
+    int tiles_x = (viewport.width + PLANE_TILE_WIDTH - 1) / PLANE_TILE_WIDTH; // Tiles per row of 3D viewport
+    int rays = PLANE_TILE_WIDTH / job->column_width;                    // Columns per tile
+    int y0 = viewport.y + (tile / tiles_x) * PLANE_TILE_HEIGHT, y1 = y0 + PLANE_TILE_HEIGHT;
+    if (y1 > viewport.y + viewport.height) y1 = viewport.y + viewport.height;
+    int r_end = (tile % tiles_x + 1) * rays;                            // Last tile of row may be narrower
+    if (r_end > job->rays) r_end = job->rays;
+
+    for (int r = (tile % tiles_x) * rays; r < r_end; r++) {
+        ColumnPlanes *col = &job->planes[r];
+        for (int k = 0; k < col->floor_count; k++) {
+            int from = col->floor_y0[k] > y0 ? col->floor_y0[k] : y0;   // Span clipped to tile
+            int to = col->floor_y1[k] < y1 ? col->floor_y1[k] : y1;
+            r_draw_plane_rows(job->cam, r, job->column_width, col->dir_x, col->dir_y, col->cos_a, from, to, job->row_scale,
+                              job->horizon, job->ground, ASSET_GROUND, OBJECT_ID(OBJECT_FLOOR, 0, 0),
+                              FLOOR_DISTANCE_DIMMING, 1.0f, FLOOR_MIN_BRIGHTNESS);
+        }
+        int from = col->ceil_y0 > y0 ? col->ceil_y0 : y0;
+        int to = col->ceil_y1 < y1 ? col->ceil_y1 : y1;
+        r_draw_plane_rows(job->cam, r, job->column_width, col->dir_x, col->dir_y, col->cos_a, from, to, job->row_scale,
+                          job->horizon - 1, job->ceiling, ASSET_CEILING, OBJECT_ID(OBJECT_CEILING, 0, 0),
+                          CEILING_DISTANCE_DIMMING, 0.85f, CEILING_MIN_BRIGHTNESS);
+    }
+}
+
+// Composite decals of wall face over wall slice of column r. Only decals whose texel columns contain textureX are
+// visited, decal texel is taken at same texture coordinates as wall texel under it and darkened and fogged like wall
+static void d_draw_column(int r, int column_width, int face, int textureX, int wallTop, int wallStart, int wallEnd,
+                          float textureStart, float textureStep, float darkening, int fog, const uint32_t *wallTexture,
+                          int textureRows) {
+    int shade = (int)(darkening * 256);
+    uint32_t fogColor = fog_add[fog];
+    for (int k = 0; k < decal_count[face]; k++) {
+        const Decal *decal = &decal_faces[face][k];
+        const DecalRect *rect = &decal_rects[decal->type];
+        int du = textureX - decal->u;
+        if (du < 0 || du >= rect->w) continue;                          // Column misses decal
+
+        for (int y = wallStart; y < wallEnd; y++) {
+            int wallY = (int)(textureStart + (y - wallTop) * textureStep); // Unwrapped texture row
+            int dv = wallY - decal->v;
+            if (dv < 0) continue;
+            if (dv >= rect->h) break;                                   // Rows below decal
+            uint32_t texel = decal_atlas[(rect->y + dv) * DECAL_ATLAS_SIZE + rect->x + du];
+            uint32_t alpha = texel >> 24;
+            if (alpha == 0) continue;
+
+            // Wall colour under decal - shaded already, except in deferred mode where pixel holds no colour yet
+            uint32_t base;
+            if (surfaces) {
+                int textureY = wallY >= textureRows ? textureRows - 1 : wallY;
+                uint32_t color = wallTexture[(textureY & (TEXTURE_SIZE - 1)) * TEXTURE_SIZE + textureX];
+                base = ((((color >> 16) & 0xFF) * shade >> 8) << 16 | (((color >> 8) & 0xFF) * shade >> 8) << 8 | ((color & 0xFF) * shade >> 8)) + fogColor;
+            } else {
+                base = pixels[y * SCREEN_WIDTH + r_column_x(r, column_width, 0)];
+            }
+            uint32_t out = 0xFF000000;
+            for (int shift = 0; shift < 24; shift += 8) {
+                uint32_t c = (((texel >> shift) & 0xFF) * shade >> 8) + ((base >> shift) & 0xFF) * (255 - alpha) / 255 +
+                             ((fogColor >> shift) & 0xFF) * alpha / 255;
+                out |= (c > 255 ? 255 : c) << shift;
+            }
             for (int i = 0; i < column_width; i++) {
-                r_drawpoint(SCREEN_WIDTH - r * column_width - i, y, floorColor);
+                r_drawpoint(r_column_x(r, column_width, i), y, out);
+                if (surfaces) r_drawsurface(r_column_x(r, column_width, i), y, 0); // Shading pass keeps composited pixel
             }
         }
-        
-        // Render ceiling texture above wall
-        for (int y = 0; y < wallTop; y++) {                             // Loop from screen top to wall top
-            // Use mirrored Y coordinate for ceiling calculation
-            int mirrorY = SCREEN_HEIGHT - 1 - y;                        // Mirror Y coordinate for ceiling
-            // Calculate distance to ceiling point using screen geometry
-            float ceilDistance = (MAP_CELL_SIZE * SCREEN_HEIGHT / 2.0f) / (mirrorY - SCREEN_HEIGHT / 2.0f);
-            ceilDistance = ceilDistance / cos(m_deg_to_rad(rangle - player.angle)); // Apply fisheye correction
-            
-            // Calculate world coordinates of ceiling point
-            float ceilX = player.x + rayDirX * ceilDistance;            // World X coordinate
-            float ceilY = player.y + rayDirY * ceilDistance;            // World Y coordinate
-            
-            // Convert to texture coordinates
-            int ceilTexX = (int)(fmod(ceilX, MAP_CELL_SIZE) * TEXTURE_SIZE / MAP_CELL_SIZE) & (TEXTURE_SIZE - 1);
-            int ceilTexY = (int)(fmod(ceilY, MAP_CELL_SIZE) * TEXTURE_SIZE / MAP_CELL_SIZE) & (TEXTURE_SIZE - 1);
-            
-            uint32_t ceilColor = ceiling[ceilTexY * TEXTURE_SIZE + ceilTexX]; // Get ceiling texture color
-            
-            // Apply distance-based darkening to ceiling (darker than floor)
-            float darkening = (1.0f - (ceilDistance / (MAP_CELL_SIZE * CEILING_DISTANCE_DIMMING))) * 0.85f;
-            if (darkening < CEILING_MIN_BRIGHTNESS) darkening = CEILING_MIN_BRIGHTNESS; // Apply minimum brightness
-            
-            // Apply darkening to color components
-            uint32_t r_comp = ((ceilColor >> 16) & 0xFF) * darkening;   // Red component
-            uint32_t g = ((ceilColor >> 8) & 0xFF) * darkening;         // Green component
-            uint32_t b = (ceilColor & 0xFF) * darkening;                // Blue component
-            ceilColor = 0xFF000000 | (r_comp << 16) | (g << 8) | b;     // Recombine color
-            
-            // Draw ceiling pixels across column width
-            for (int i = 0; i < column_width; i++) {
-                r_drawpoint(SCREEN_WIDTH - r * column_width - i, y, ceilColor);
+    }
+}
+
+// Shade count surface records into pixels and add fog colour of their fog level. Records with asset 0 leave pixel as it is.
+// SSE2 version shades four pixels per iteration on 16-bit channels, results match scalar tail exactly
+static void r_shade_surfaces(const uint32_t *records, uint32_t *out, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 4 <= count; i += 4) {
+        uint32_t texel[4], fog[4];
+        int light[4];
+        int keep = 0;                                                   // Lanes without surface
+        for (int k = 0; k < 4; k++) {
+            uint32_t record = records[i + k];
+            if (record >> 28 == 0) {
+                texel[k] = out[i + k];
+                light[k] = 256;
+                fog[k] = 0;
+                keep |= 1 << k;
+                continue;
             }
+            const uint32_t *tex = asset_pixels[(record >> 28) - 1];
+            texel[k] = tex[((record >> 6) & (TEXTURE_SIZE - 1)) * TEXTURE_SIZE + (record & (TEXTURE_SIZE - 1))];
+            light[k] = (record >> 12) & 0x1FF;
+            fog[k] = fog_add[(record >> 24) & 0xF];
         }
+        __m128i c = _mm_loadu_si128((const __m128i *)texel);
+        __m128i lo = _mm_unpacklo_epi8(c, zero), hi = _mm_unpackhi_epi8(c, zero); // 16-bit channels of pixels 0-1 and 2-3
+        lo = _mm_srli_epi16(_mm_mullo_epi16(lo, _mm_set_epi16(light[1], light[1], light[1], light[1], light[0], light[0], light[0], light[0])), 8);
+        hi = _mm_srli_epi16(_mm_mullo_epi16(hi, _mm_set_epi16(light[3], light[3], light[3], light[3], light[2], light[2], light[2], light[2])), 8);
+        __m128i shaded = _mm_or_si128(_mm_packus_epi16(lo, hi), alpha);
+        shaded = _mm_adds_epu8(shaded, _mm_loadu_si128((const __m128i *)fog)); // Fog colour of level
+        if (keep) {                                                     // Put back pixels drawn directly
+            __m128i mask = _mm_set_epi32(keep & 8 ? -1 : 0, keep & 4 ? -1 : 0, keep & 2 ? -1 : 0, keep & 1 ? -1 : 0);
+            shaded = _mm_or_si128(_mm_and_si128(mask, c), _mm_andnot_si128(mask, shaded));
+        }
+        _mm_storeu_si128((__m128i *)(out + i), shaded);
+    }
+#endif
+    for (; i < count; i++) {                                            // Scalar version (tail or no SSE2)
+        uint32_t record = records[i];
+        if (record >> 28 == 0) continue;
+        const uint32_t *tex = asset_pixels[(record >> 28) - 1];
+        uint32_t color = tex[((record >> 6) & (TEXTURE_SIZE - 1)) * TEXTURE_SIZE + (record & (TEXTURE_SIZE - 1))];
+        int light = (record >> 12) & 0x1FF;
+        uint32_t r_comp = (((color >> 16) & 0xFF) * light) >> 8;
+        uint32_t g = (((color >> 8) & 0xFF) * light) >> 8;
+        uint32_t b = ((color & 0xFF) * light) >> 8;
+        out[i] = (0xFF000000 | (r_comp << 16) | (g << 8) | b) + fog_add[(record >> 24) & 0xF];
+    }
+}
+
+// Shading pass job state
+typedef struct {
+    uint32_t *target;                                                   // Framebuffer of calling thread
+    const uint32_t *surfaces;                                           // Surface buffer of calling thread
+    Viewport viewport;                                                  // Viewport to shade
+} ResolveJob;
+
+// Shade band of PLANE_TILE_HEIGHT rows - every row is one linear sweep over records and pixels
+static void r_resolve_job(void *data, int band) {
+    ResolveJob *job = data;
+    int y0 = job->viewport.y + band * PLANE_TILE_HEIGHT, y1 = y0 + PLANE_TILE_HEIGHT;
+    if (y1 > job->viewport.y + job->viewport.height) y1 = job->viewport.y + job->viewport.height;
+    for (int y = y0; y < y1; y++) {
+        int index = y * SCREEN_WIDTH + job->viewport.x;
+        r_shade_surfaces(job->surfaces + index, job->target + index, job->viewport.width);
+    }
+}
+
+// Deferred shading pass - resolve surface records of current viewport into pixels on worker pool
+void r_resolve_surfaces(void) {
+    ResolveJob job = { pixels, surfaces, viewport };
+    jobs_run(r_resolve_job, &job, (viewport.height + PLANE_TILE_HEIGHT - 1) / PLANE_TILE_HEIGHT);
+}
+
+// Main raycasting function - renders 3D view.
+// Every ray walks the map front to back. Rows of its column not yet covered are kept in range [ytop, ybot) (y-buffer):
+// floor, wall faces and tops of low walls fill it from the bottom up, so walls behind lower walls stay visible
+// and ray stops as soon as nothing taller can show up above covered part, or when it reaches view distance. Floor and
+// ceiling rows are only recorded and filled afterwards in screen tiles on worker pool
+void r_raycast(struct Player *cam, const SceneFrame *frame) {
+    int r;                                                              // Ray counter variable
+    float rangle = cam->angle - FOV / 2.0f;                             // Starting ray angle (leftmost ray)
+    const int horizon = viewport.y + viewport.height / 2 + (int)cam->pitch; // Screen row of horizon (moves with pitch)
+    const int vp_bottom = viewport.y + viewport.height;                 // First row below 3D viewport
+    const float proj = (float)viewport.width;                           // Projection scale (screen rows of one world unit at distance 1)
+    const float eye = MAP_CELL_SIZE / 2.0f;                             // Eye height above floor (walls are centered on horizon)
+    int rays = r_ray_count();                                           // Rays of viewport
+    float angle_step = (float)FOV / (float)rays;                        // Angle increment between rays
+    int column_width = r_column_width();                                // Width of each rendered column
+    
+    // Arrays to store wall distances and occluders for sprite depth testing
+    float wall_distances[RAY_COUNT];                                    // Store distance for each ray
+    ColumnOcclusion occlusion[RAY_COUNT];                               // Walls covering each column
+    ColumnPlanes planes[RAY_COUNT];                                     // Floor and ceiling rows of each column
+    const uint32_t *ground = frame->ground;                             // Current floor texture from asset table
+    const uint32_t *ceiling = frame->ceiling;                           // Current ceiling texture from asset table
+    
+    cam->ray_count = rays;                                              // Map overlay and crosshair read rays_d outside this viewport
+    cam->hit_face = -1;                                                 // Until centre ray hits wall
+    Visibility *vis = cam->visibility;                                  // Optional visible cell/sprite output
+    if (vis) {
+        memset(vis->cells, 0, sizeof(vis->cells));
+        vis->sprite_count = 0;
+        int cell = cam->cell_y * MAPX + cam->cell_x;                    // Player always sees own cell
+        if (cam->cell_x >= 0 && cam->cell_x < MAPX && cam->cell_y >= 0 && cam->cell_y < MAPY) vis->cells[cell >> 5] |= 1u << (cell & 31);
+    }
+    if (surfaces) {                                                     // Records of last frame must not survive in uncovered pixels
+        for (int y = viewport.y; y < vp_bottom; y++) memset(surfaces + y * SCREEN_WIDTH + viewport.x, 0, viewport.width * 4);
+    }
+
+    Uint64 strip_start = 0;                                             // Start time of current strip (strip time heatmap)
+    int cells_tested = 0;                                               // Map cells tested by current ray (traversal heatmap)
+
+    // Cast rays from left to right across field of view
+    for (r = 0; r < rays; r++) {                                        // Loop through each ray
+        if (debug_view == DEBUG_VIEW_STRIP_TIME && r % DEBUG_STRIP_RAYS == 0) strip_start = SDL_GetPerformanceCounter();
+        cells_tested = 0;
+        float rayAngleRad = m_deg_to_rad(rangle);                       // Convert ray angle to radians
+        float rayDirX = cos(rayAngleRad);                               // X component of ray direction
+        float rayDirY = -sin(rayAngleRad);                              // Y component of ray direction (negative for screen coordinates)
+        double cosA = cos(m_deg_to_rad(rangle - cam->angle));           // Fisheye correction factor
         
-        // Render textured wall slice
-        uint32_t* wallTexture = r_get_wall_texture(currentWallType);    // Get appropriate wall texture
-
-        // Draw wall pixels from top to bottom
-        for (int y = wallTop; y < wallBottom; y++) {                    // Loop through wall height
-            // Calculate texture Y coordinate for this pixel
-            float textureYFloat = textureStart + (y - wallTop) * textureStep;
-            int textureY = (int)textureYFloat;                          // Convert to integer
-            
-            // Clamp texture Y to valid range
-            if (textureY >= TEXTURE_SIZE) textureY = TEXTURE_SIZE - 1;
-            if (textureY < 0) textureY = 0;                           
-            
-            // Get texture color at calculated coordinates
-            uint32_t textureColor = wallTexture[textureY * TEXTURE_SIZE + textureX];
+        // Prepare grid traversal - distances along ray to first vertical and horizontal grid line
+        int mapX = cam->cell_x;                                         // Map cell of player
+        int mapY = cam->cell_y;
+        int stepX = rayDirX < 0 ? -1 : 1;                               // Cell step direction
+        int stepY = rayDirY < 0 ? -1 : 1;
+        float deltaDistX = rayDirX != 0 ? fabsf(MAP_CELL_SIZE / rayDirX) : 1e30f; // Ray length between vertical grid lines
+        float deltaDistY = rayDirY != 0 ? fabsf(MAP_CELL_SIZE / rayDirY) : 1e30f; // Ray length between horizontal grid lines
+        float sideDistX = rayDirX < 0 ? cam->off_x / -rayDirX : (MAP_CELL_SIZE - cam->off_x) / rayDirX;
+        float sideDistY = rayDirY < 0 ? cam->off_y / -rayDirY : (MAP_CELL_SIZE - cam->off_y) / rayDirY;
+        if (rayDirX == 0) sideDistX = 1e30f;
+        if (rayDirY == 0) sideDistY = 1e30f;
+
+        int ytop = viewport.y, ybot = vp_bottom;                        // Rows of column not covered yet
+        wall_distances[r] = 1000000;                                    // No wall hit yet
+        cam->rays_d[r] = 1000000;
+        occlusion[r].count = 0;
+        ColumnPlanes *col = &planes[r];
+        col->dir_x = rayDirX;
+        col->dir_y = rayDirY;
+        col->cos_a = cosA;
+        col->floor_count = 0;
+
+        // Step along ray from cell to cell
+        for (int depth = 0; depth < MAPX + MAPY && ytop < ybot; depth++) {
+            bool hitVertical;                                           // Ray crossed vertical grid line (x = const)
+            float distance;                                             // Distance along ray to entered cell
+            if (sideDistX < sideDistY) {
+                distance = sideDistX;
+                sideDistX += deltaDistX;
+                mapX += stepX;
+                hitVertical = true;
+            } else {
+                distance = sideDistY;
+                sideDistY += deltaDistY;
+                mapY += stepY;
+                hitVertical = false;
+            }
+            if (view_distance > 0 && distance * cosA >= view_distance) break; // Rest of ray is hidden in fog
+
+            // Check map boundaries
+            if (mapX < 0 || mapX >= MAPX || mapY < 0 || mapY >= MAPY) {
+                break;                                                  // Hit map boundary, stop checking
+            }
+            cells_tested++;
+            if (vis) vis->cells[(mapY * MAPX + mapX) >> 5] |= 1u << ((mapY * MAPX + mapX) & 31); // Ray reached this cell
+
+            int currentWallType = map[mapY * MAPX + mapX];
+            if (currentWallType == 0) continue;                         // Empty cell, keep walking
+
+            float hitX = cam->off_x + rayDirX * distance;               // Hit coordinates relative to player cell
+            float hitY = cam->off_y + rayDirY * distance;
+            float wallCells = map_heights[mapY * MAPX + mapX];          // Wall height in cells
+
+            // Apply fisheye correction to prevent distortion
+            float correctedDistance = distance * cosA;
+            if (correctedDistance < 0.01f) correctedDistance = 0.01f;   // Guard against division by zero
+
+            // Nearest wall is used for player data, depth of sprites and debug ray
+            if (occlusion[r].count == 0) {
+                cam->rays_d[r] = correctedDistance;                     // Store corrected distance in player data
+                wall_distances[r] = correctedDistance;                  // Store for sprite depth testing
+            }
+
+            // Calculate wall bounds - bottom stays on floor, top depends on wall height
+            float cellHeight = MAP_CELL_SIZE * proj / correctedDistance; // Height of one cell on screen
+            float wallHeight = cellHeight * wallCells;                  // Wall height on screen
+            float wallTopF = horizon + cellHeight / 2.0f - wallHeight;  // Unclipped top edge
+            float textureStep = (float)TEXTURE_SIZE / cellHeight;       // Texture step per pixel (texture repeats every cell)
+            int wallTop, wallBottom;                                    // Top and bottom pixel coordinates for wall
+            float textureStart;                                         // Texture coordinate at wallTop
+            if (wallTopF < viewport.y) {                                // Wall extends above viewport
+                wallTop = viewport.y;                                   // Start at top of viewport
+                wallBottom = wallTopF + wallHeight;                     // Calculate bottom position
+                textureStart = (viewport.y - wallTopF) * textureStep;   // Skip texture part above viewport
+            } else {                                                    // Wall top is visible
+                wallTop = wallTopF;                                     // Start at wall top
+                wallBottom = wallTop + wallHeight;                      // Calculate bottom position
+                textureStart = 0;                                       // Start from top of texture
+            }
+            if (wallBottom > vp_bottom) wallBottom = vp_bottom;         // Clip to bottom of viewport
+
+            // Render floor between previous geometry and this wall
+            int floorStart = wallBottom > horizon ? wallBottom : horizon + 1;
+            if (floorStart < ytop) floorStart = ytop;
+            if (floorStart < ybot) {
+                if (col->floor_count < MAX_COLUMN_OCCLUDERS) {          // Last span is kept free for floor behind last wall
+                    col->floor_y0[col->floor_count] = floorStart;
+                    col->floor_y1[col->floor_count++] = ybot;
+                } else {                                                // Rare column with many walls - draw right away
+                    r_draw_plane_rows(cam, r, column_width, rayDirX, rayDirY, cosA, floorStart, ybot, eye * proj, horizon,
+                                      ground, ASSET_GROUND, OBJECT_ID(OBJECT_FLOOR, 0, 0), FLOOR_DISTANCE_DIMMING, 1.0f, FLOOR_MIN_BRIGHTNESS);
+                }
+                ybot = floorStart;
+            }
+
+            // Calculate texture X coordinate based on hit position
+            float wallHitOffset;                                        // Offset within the wall cell
+            if (hitVertical) {                                          // Hit vertical wall
+                wallHitOffset = hitY - (mapY - cam->cell_y) * MAP_CELL_SIZE; // Use Y coordinate for texture X
+            } else {                                                    // Hit horizontal wall
+                wallHitOffset = hitX - (mapX - cam->cell_x) * MAP_CELL_SIZE; // Use X coordinate for texture X
+            }
+
+            // Convert wall offset to texture coordinate
+            int textureX = (int)(wallHitOffset * TEXTURE_SIZE / MAP_CELL_SIZE);
+            if (textureX >= TEXTURE_SIZE) textureX = TEXTURE_SIZE - 1;  // Clamp to texture bounds
+            if (textureX < 0) textureX = 0;
+
+            // Render textured wall slice into uncovered rows
+            int wallAsset = r_wall_asset(currentWallType);              // Asset of wall texture
+            const uint32_t* wallTexture = asset_pixels[wallAsset];      // Get appropriate wall texture
+            int textureRows = (int)ceilf(wallCells * TEXTURE_SIZE);    // Texture rows covering whole wall
             
             // Apply distance-based darkening to wall
             float wallDarkening = 1.0f - (correctedDistance / (MAP_CELL_SIZE * WALL_DISTANCE_DIMMING));
             if (wallDarkening < WALL_MIN_BRIGHTNESS) wallDarkening = WALL_MIN_BRIGHTNESS; // Apply minimum brightness
-            
+
             // Make vertical walls slightly darker for depth perception
             if (hitVertical) {
                 wallDarkening *= 0.8f;                                  // Darken vertical walls
             }
-            
-            // Apply darkening to color components
-            uint32_t r_comp = ((textureColor >> 16) & 0xFF) * wallDarkening; // Red component
-            uint32_t g = ((textureColor >> 8) & 0xFF) * wallDarkening;  // Green component
-            uint32_t b = (textureColor & 0xFF) * wallDarkening;         // Blue component
-            textureColor = 0xFF000000 | (r_comp << 16) | (g << 8) | b;  // Recombine color
-            
-            // Draw wall pixels across column width
-            for (int i = 0; i < column_width; i++) {
-                r_drawpoint(SCREEN_WIDTH - r * column_width - i, y, textureColor);
+            int wallFog = r_fog_level(correctedDistance);
+            wallDarkening *= fog_scale[wallFog];
+
+            // Draw wall pixels from top to bottom
+            int wallStart = wallTop > ytop ? wallTop : ytop;
+            int wallEnd = wallBottom < ybot ? wallBottom : ybot;
+            bool filter = bilinear_filter && !surfaces;                 // Surface records hold single texel
+            if (filter && wallEnd > wallStart) {                        // Filtered wall slice
+                int u[SCREEN_HEIGHT], v[SCREEN_HEIGHT], shade[SCREEN_HEIGHT], fogs[SCREEN_HEIGHT];
+                int texU = (int)(wallHitOffset * TEXTURE_SIZE / MAP_CELL_SIZE * 65536.0f) - 32768;
+                int wallShade = (int)(wallDarkening * 256);
+                int maxV = (textureRows - 1) << 16;                     // Rows are clamped like nearest path, texture wraps only between repeats
+                for (int y = wallStart; y < wallEnd; y++) {
+                    int texV = (int)((textureStart + (y - wallTop) * textureStep) * 65536.0f) - 32768;
+                    u[y - wallStart] = texU;
+                    v[y - wallStart] = texV < 0 ? 0 : texV > maxV ? maxV : texV;
+                    shade[y - wallStart] = wallShade;
+                    fogs[y - wallStart] = wallFog;
+                }
+                r_draw_span_bilinear(r, column_width, wallStart, wallEnd - wallStart, wallTexture, u, v, shade, fogs);
+            }
+            if (object_ids) {                                           // Whole slice belongs to one wall cell
+                uint32_t id = OBJECT_ID(OBJECT_WALL, currentWallType, mapY * MAPX + mapX);
+                for (int y = wallStart; y < wallEnd; y++) {
+                    for (int i = 0; i < column_width; i++) r_drawid(r_column_x(r, column_width, i), y, id);
+                }
+            }
+            int nearestEnd = filter ? wallStart : wallEnd;              // Nearest neighbour rows (none when filtered)
+            for (int y = wallStart; y < nearestEnd; y++) {              // Loop through visible wall height
+                // Calculate texture Y coordinate for this pixel
+                float textureYFloat = textureStart + (y - wallTop) * textureStep;
+                int textureY = (int)textureYFloat;                      // Convert to integer
+
+                // Clamp texture Y to valid range, taller walls repeat texture
+                if (textureY >= textureRows) textureY = textureRows - 1;
+                if (textureY < 0) textureY = 0;
+                textureY &= TEXTURE_SIZE - 1;
+
+                if (surfaces) {                                         // Deferred - shading pass fetches texel
+                    uint32_t record = SURFACE_RECORD(wallAsset, textureX, textureY, (int)(wallDarkening * 256), wallFog);
+                    for (int i = 0; i < column_width; i++) r_drawsurface(r_column_x(r, column_width, i), y, record);
+                    continue;
+                }
+
+                // Get texture color at calculated coordinates
+                uint32_t textureColor = wallTexture[textureY * TEXTURE_SIZE + textureX];
+
+                // Apply darkening to color components
+                uint32_t r_comp = ((textureColor >> 16) & 0xFF) * wallDarkening; // Red component
+                uint32_t g = ((textureColor >> 8) & 0xFF) * wallDarkening; // Green component
+                uint32_t b = (textureColor & 0xFF) * wallDarkening;     // Blue component
+                textureColor = (0xFF000000 | (r_comp << 16) | (g << 8) | b) + fog_add[wallFog]; // Recombine color
+
+                // Draw wall pixels across column width
+                for (int i = 0; i < column_width; i++) {
+                    r_drawpoint(r_column_x(r, column_width, i), y, textureColor);
+                }
+            }
+            int face = (mapY * MAPX + mapX) * 4 + (hitVertical ? (stepX > 0 ? FACE_WEST : FACE_EAST) : (stepY > 0 ? FACE_NORTH : FACE_SOUTH));
+            if (r == rays / 2 && occlusion[r].count == 0) {             // Nearest wall of centre ray is what crosshair hits
+                cam->hit_face = face;
+                cam->hit_u = textureX;
+            }
+            if (decal_count[face] && wallEnd > wallStart) {             // Faces without decals cost this test only
+                d_draw_column(r, column_width, face, textureX, wallTop, wallStart, wallEnd, textureStart, textureStep,
+                              wallDarkening, wallFog, wallTexture, textureRows);
+            }
+            if (wallEnd > wallStart || wallStart >= ybot) ybot = wallStart > ytop ? wallStart : ytop;
+
+            // Top of wall lower than eye is visible - draw it up to far edge of cell
+            float wallElevation = wallCells * MAP_CELL_SIZE;            // Wall height in world units
+            if (wallElevation < eye && ytop < ybot) {
+                float exitDistance = (sideDistX < sideDistY ? sideDistX : sideDistY) * cosA; // Ray leaves wall cell here
+                int roofTop = horizon + (int)((eye - wallElevation) * proj / exitDistance) + 1;
+                if (roofTop < ytop) roofTop = ytop;
+                r_draw_plane_rows(cam, r, column_width, rayDirX, rayDirY, cosA, roofTop, ybot, (eye - wallElevation) * proj,
+                                  horizon, wallTexture, wallAsset, OBJECT_ID(OBJECT_WALL_TOP, currentWallType, 0),
+                                  WALL_DISTANCE_DIMMING, 0.9f, WALL_MIN_BRIGHTNESS);
+                if (ybot > roofTop) ybot = roofTop;
+            }
+
+            // Remember wall for sprite clipping
+            if (occlusion[r].count < MAX_COLUMN_OCCLUDERS) {
+                occlusion[r].dist[occlusion[r].count] = correctedDistance;
+                occlusion[r].clip[occlusion[r].count] = ybot;
+                occlusion[r].count++;
             }
+
+            // Walls further away are drawn closer to horizon - stop when even tallest wall can't reach uncovered rows
+            if (ybot <= horizon + (eye - MAX_WALL_HEIGHT * MAP_CELL_SIZE) * proj / correctedDistance) break;
+        }
+
+        // Rows at horizon are infinitely far - with view distance they are fog, as nothing can reach them
+        if (view_distance > 0) {
+            int fogStart = horizon - 1 > ytop ? horizon - 1 : ytop, fogEnd = horizon + 1 < ybot ? horizon + 1 : ybot;
+            if (fogStart < fogEnd) r_draw_fog_rows(r, column_width, fogStart, fogEnd);
+        }
+
+        // Ceiling goes into rows which stayed uncovered above horizon (and floor below it, if ray left the map)
+        col->ceil_y0 = ytop;
+        col->ceil_y1 = ybot < horizon - 1 ? ybot : horizon - 1;
+        int floorStart = ytop > horizon ? ytop : horizon + 1;
+        if (floorStart < ybot) {
+            col->floor_y0[col->floor_count] = floorStart;
+            col->floor_y1[col->floor_count++] = ybot;
         }
         
         rangle = rangle + angle_step;                                   // Move to next ray angle
+
+        // Debug view statistics
+        if (debug_view == DEBUG_VIEW_TRAVERSAL) debug_column_cells[r] = cells_tested;
+        if (debug_view == DEBUG_VIEW_STRIP_TIME && r % DEBUG_STRIP_RAYS == DEBUG_STRIP_RAYS - 1) {
+            debug_strip_time[r / DEBUG_STRIP_RAYS] = SDL_GetPerformanceCounter() - strip_start;
+        }
+    }
+
+    // Fill floor and ceiling tile by tile, tiles are independent so they run on worker pool
+    PlaneJob plane_job = {
+        .cam = cam, .planes = planes, .column_width = column_width, .horizon = horizon, .rays = rays, .row_scale = eye * proj,
+        .ground = ground, .ceiling = ceiling, .target = pixels, .surfaces = surfaces, .object_ids = object_ids,
+        .viewport = viewport,
+    };
+    int tiles_x = (viewport.width + PLANE_TILE_WIDTH - 1) / PLANE_TILE_WIDTH;
+    int tiles_y = (viewport.height + PLANE_TILE_HEIGHT - 1) / PLANE_TILE_HEIGHT;
+    jobs_run(r_plane_tile_job, &plane_job, tiles_x * tiles_y);
+    pixels = plane_job.target;                                          // Calling thread rendered tiles too
+    viewport = plane_job.viewport;
+
+    r_render_sprites(cam, frame, wall_distances, occlusion, column_width); // Render sprites after walls are drawn
+    if (surfaces) r_resolve_surfaces();                                 // Deferred - shade whole view in one sweep
+    p_render(cam, wall_distances, occlusion, column_width);             // Particles blend over shaded scene
+}
+
+// Draw rays of last rendered view into 2D map - every 4th ray to reduce visual clutter, rays which left map are skipped
+void r_draw_rays(struct Player *cam) {
+    int rays = cam->ray_count;                                          // Runs in map stage, so rays of 3D view come with camera
+    float rangle = cam->angle - FOV / 2.0f;                             // Same angles as r_raycast()
+    float angle_step = (float)FOV / (float)rays;
+    int camX = cam->cell_x * MAP_CELL_SIZE, camY = cam->cell_y * MAP_CELL_SIZE; // Player cell origin on 2D map
+    for (int r = 0; r < rays; r++, rangle += angle_step) {
+        if (r % 4 != 0 || cam->rays_d[r] >= 1000000) continue;
+        float rayAngleRad = m_deg_to_rad(rangle);
+        float rayDirX = cos(rayAngleRad), rayDirY = -sin(rayAngleRad);
+        float distance = cam->rays_d[r] / cos(m_deg_to_rad(rangle - cam->angle)); // Undo fisheye correction
+        float hitX = cam->off_x + rayDirX * distance;                   // Hit coordinates relative to player cell
+        float hitY = cam->off_y + rayDirY * distance;
+        r_drawline(camX + (int)(cam->off_x + 5), camY + (int)(cam->off_y + 5), // Draw cyan debug ray
+                   camX + (int)floorf(hitX), camY + (int)floorf(hitY), 0xFF00BBBB);
     }
-    r_render_sprites(wall_distances, column_width);                     // Render sprites after walls are drawn
 }
 
-// Get the appropriate texture based on wall type
-uint32_t* r_get_wall_texture(int wall_type) {
+// Get asset id of texture for wall type
+int r_wall_asset(int wall_type) {
     switch(wall_type) {                                                 // Switch on wall type value
-        case 1: return greystone;                                       // Stone wall texture
-        case 2: return mossy;                                           // Mossy stone wall texture
-        case 3: return colorstone;                                      // Colored stone wall texture
-        default: return greystone;                                      // Default to stone if unknown type
+        case 1: return ASSET_GREYSTONE;                                 // Stone wall texture
+        case 2: return ASSET_MOSSY;                                     // Mossy stone wall texture
+        case 3: return ASSET_COLORSTONE;                                // Colored stone wall texture
+        default: return ASSET_GREYSTONE;                                // Default to stone if unknown type
     }
 }
 
-// Get the appropriate sprite based on sprite type
-uint32_t* r_get_sprite(int sprite_type){
+// Get the appropriate texture based on wall type
+const uint32_t* r_get_wall_texture(int wall_type) {
+    return asset_pixels[r_wall_asset(wall_type)];
+}
+
+// Get asset id of image for sprite type
+int r_sprite_asset(int sprite_type) {
     switch(sprite_type) {                                               // Switch on sprite type value
-        case 1: return hangman;                                         // Hangman sprite
-        case 2: return barrel;                                          // Barrel sprite
-        case 3: return armor_suit;                                      // Armor suit sprite
-        case 4: return bed;                                             // Bed sprite
-        case 5: return plant;                                           // Plant sprite
-        case 6: return sink;                                            // Sink sprite
-        case 7: return dead_plant;                                      // Dead plant sprite
-        case 8: return light;                                           // Ceiling light sprite
-        default: return light;                                          // Default to ceiling light if unknown type
+        case 1: return ASSET_HANGMAN;                                   // Hangman sprite
+        case 2: return ASSET_BARREL;                                    // Barrel sprite
+        case 3: return ASSET_ARMOR_SUIT;                                // Armor suit sprite
+        case 4: return ASSET_BED;                                       // Bed sprite
+        case 5: return ASSET_PLANT;                                     // Plant sprite
+        case 6: return ASSET_SINK;                                      // Sink sprite
+        case 7: return ASSET_DEAD_PLANT;                                // Dead plant sprite
+        case 8: return ASSET_LIGHT;                                     // Ceiling light sprite
+        default: return ASSET_LIGHT;                                    // Default to ceiling light if unknown type
     }
 }
 
+// Get the appropriate sprite based on sprite type
+const uint32_t* r_get_sprite(int sprite_type){
+    return asset_pixels[r_sprite_asset(sprite_type)];
+}
+
 // Draw filled rectangle
 void r_drawrectangle(int x, int y, int size, uint32_t color) {
     // Draw horizontal lines to fill rectangle
@@ -785,60 +2046,271 @@ void process_inputs(void) {
                     engine_on = false;                                  // Set flag to exit main loop
                     break;                                              // Exit switch statement
                 }
+                if (event.key.repeat) break;                            // Toggles below react only to first press
+                if (event.key.keysym.sym == SDLK_F9 || event.key.keysym.sym == SDLK_F10) { // F9 = Y4M, F10 = raw recording
+                    if (capture_thread) {
+                        v_capture_stop();                               // Second press stops recording
+                    } else {
+                        bool y4m = event.key.keysym.sym == SDLK_F9;
+                        char path[64];
+                        snprintf(path, sizeof(path), "capture_%u.%s", SDL_GetTicks(), y4m ? "y4m" : "raw");
+                        v_capture_start(path, y4m);
+                    }
+                }
+                if (event.key.keysym.sym == SDLK_F3) {                  // F3 = cycle debug heatmap views
+                    static const char *names[DEBUG_VIEW_COUNT] = { "off", "overdraw", "cells traversed", "strip render time" };
+                    debug_view = (debug_view + 1) % DEBUG_VIEW_COUNT;
+                    memset(debug_overdraw, 0, sizeof(debug_overdraw));  // Start counting from clean state
+                    printf("Debug view: %s\n", names[debug_view]);
+                    scene_generation++;                                 // Redraw with new view
+                }
+                if (event.key.keysym.sym == SDLK_LCTRL) {               // Left Ctrl = fire, pick object under crosshair
+                    int aim_x = viewport.x + viewport.width / 2, aim_y = viewport.y + viewport.height / 2; // Crosshair at view centre
+                    uint32_t target = vis_pick(aim_x, aim_y);
+                    vis_print_object(target);
+                    if (scene_type == SCENE_DUNGEON) {
+                        p_fire(&view_player);
+                        d_shoot(&view_player, target >> 28 == OBJECT_SPRITE); // Shot through sprite splashes wall behind it
+                    }
+                }
+                if (event.key.keysym.sym == SDLK_F2) {                  // F2 = toggle deferred shading (visibility + shading pass)
+                    deferred_shading = !deferred_shading;
+                    printf("Deferred shading: %s\n", deferred_shading ? "on" : "off");
+                    scene_generation++;
+                }
+                if (event.key.keysym.sym == SDLK_F4) {                  // F4 = toggle picture-in-picture security camera
+                    pip_on = !pip_on;
+                    scene_generation++;
+                }
+                if (event.key.keysym.sym == SDLK_F6) {                  // F6 = switch dungeon / heightmap terrain
+                    SDL_LockMutex(sim_lock);                            // Player is moved to other world
+                    t_set_scene(scene_type == SCENE_TERRAIN ? SCENE_DUNGEON : SCENE_TERRAIN);
+                    sim_reset();
+                    SDL_UnlockMutex(sim_lock);
+                }
+                if (event.key.keysym.sym == SDLK_F11) {                 // F11 = cycle view distance (unlimited, 8, 5, 3 cells)
+                    static const float distances[] = { 0, 8, 5, 3 };
+                    int next = 0;
+                    while (next < 3 && distances[next] * MAP_CELL_SIZE != view_distance) next++;
+                    r_set_view_distance(distances[(next + 1) % 4]);
+                    if (view_distance > 0) printf("View distance: %g cells\n", view_distance / MAP_CELL_SIZE);
+                    else printf("View distance: unlimited\n");
+                    scene_generation++;
+                }
+                if (event.key.keysym.sym == SDLK_F7) {                  // F7 = toggle bilinear texture filtering
+                    bilinear_filter = !bilinear_filter;
+                    scene_generation++;
+                }
+                if (event.key.keysym.sym == SDLK_F5) {                  // F5 = quicksave (memory and disk)
+                    SDL_LockMutex(sim_lock);                            // Consistent player pose
+                    snapshot_save(&quicksave);
+                    SDL_UnlockMutex(sim_lock);
+                    quicksave_valid = true;
+                    snapshot_write(&quicksave, SNAPSHOT_FILE);
+                }
+                if (event.key.keysym.sym == SDLK_F8) {                  // F8 = quickload (memory, or disk after restart)
+                    if (!quicksave_valid) quicksave_valid = snapshot_read(&quicksave, SNAPSHOT_FILE);
+                    if (quicksave_valid) {
+                        SDL_LockMutex(sim_lock);                        // Simulation must not walk through changing map
+                        snapshot_restore(&quicksave);
+                        sim_reset();
+                        SDL_UnlockMutex(sim_lock);
+                    }
+                }
+                break;
         }
     }
     
-    // Handle continuous keyboard input
+    // Handle continuous keyboard input - simulation thread reads held keys on its next tick
     const Uint8 *keystate = SDL_GetKeyboardState(NULL);                 // Get current keyboard state array
+    int keys = 0;
+    if (keystate[SDL_SCANCODE_LEFT] || keystate[SDL_SCANCODE_A]) keys |= SIM_KEY_LEFT;      // Left arrow or A key pressed
+    if (keystate[SDL_SCANCODE_RIGHT] || keystate[SDL_SCANCODE_D]) keys |= SIM_KEY_RIGHT;    // Right arrow or D key pressed
+    if (keystate[SDL_SCANCODE_UP] || keystate[SDL_SCANCODE_W]) keys |= SIM_KEY_FORWARD;     // Up arrow or W key pressed
+    if (keystate[SDL_SCANCODE_DOWN] || keystate[SDL_SCANCODE_S]) keys |= SIM_KEY_BACK;      // Down arrow or S key pressed
+    SDL_AtomicSet(&sim_keys, keys);
+}
+
+// Simulation tick - move player by held keys and pan security camera (caller holds sim_lock)
+static void sim_tick(int keys) {
+    const float turn = PLAYER_TURN_SPEED / SIM_TICK_RATE;               // Degrees per tick
+    const float step = PLAYER_MOVE_SPEED / SIM_TICK_RATE;               // World units per tick
     
     // Handle rotation input
-    if (keystate[SDL_SCANCODE_LEFT] || keystate[SDL_SCANCODE_A]) {      // Left arrow or A key pressed
-        player.angle += 1.8;                                            // Rotate counterclockwise
+    if (keys & SIM_KEY_LEFT) {                                          // Left arrow or A key pressed
+        player.angle += turn;                                           // Rotate counterclockwise
         player.angle = m_fix_ang(player.angle);                         // Normalize angle to 0-359 range
         player.dx = cos(m_deg_to_rad(player.angle));                    // Update direction X component
         player.dy = -sin(m_deg_to_rad(player.angle));                   // Update direction Y component (negative for screen coords)
     }
     
-    if (keystate[SDL_SCANCODE_RIGHT] || keystate[SDL_SCANCODE_D]) {     // Right arrow or D key pressed
-        player.angle -= 1.8;                                            // Rotate clockwise
+    if (keys & SIM_KEY_RIGHT) {                                         // Right arrow or D key pressed
+        player.angle -= turn;                                           // Rotate clockwise
         player.angle = m_fix_ang(player.angle);                         // Normalize angle to 0-359 range
         player.dx = cos(m_deg_to_rad(player.angle));                    // Update direction X component
         player.dy = -sin(m_deg_to_rad(player.angle));                   // Update direction Y component (negative for screen coords)
     }
     
     // Handle forward/backward movement with collision detection
-    if (keystate[SDL_SCANCODE_UP] || keystate[SDL_SCANCODE_W]) {        // Up arrow or W key pressed
-        float new_x = player.x + player.dx * 2.5;                       // Calculate new X position (forward)
-        float new_y = player.y + player.dy * 2.5;                       // Calculate new Y position (forward)
+    if (keys & SIM_KEY_FORWARD) {                                       // Up arrow or W key pressed
+        float new_x = player.off_x + player.dx * step;                  // Calculate new X offset (forward)
+        float new_y = player.off_y + player.dy * step;                  // Calculate new Y offset (forward)
         
         // Check collision before moving (separate X and Y for wall sliding)
-        if (!check_collision(new_x, player.y)) {                        // Check X movement collision
-            player.x = new_x;                                           // Move in X direction if no collision
+        if (!check_collision(player.cell_x, player.cell_y, new_x, player.off_y)) { // Check X movement collision
+            player.off_x = new_x;                                       // Move in X direction if no collision
+            m_cell_normalize(&player.cell_x, &player.off_x);            // Crossed into neighbour cell
         }
-        if (!check_collision(player.x, new_y)) {                        // Check Y movement collision
-            player.y = new_y;                                           // Move in Y direction if no collision
+        if (!check_collision(player.cell_x, player.cell_y, player.off_x, new_y)) { // Check Y movement collision
+            player.off_y = new_y;                                       // Move in Y direction if no collision
+            m_cell_normalize(&player.cell_y, &player.off_y);            // Crossed into neighbour cell
         }
     }
     
-    if (keystate[SDL_SCANCODE_DOWN] || keystate[SDL_SCANCODE_S]) {      // Down arrow or S key pressed
-        float new_x = player.x - player.dx * 2.5;                       // Calculate new X position (backward)
-        float new_y = player.y - player.dy * 2.5;                       // Calculate new Y position (backward)
+    if (keys & SIM_KEY_BACK) {                                          // Down arrow or S key pressed
+        float new_x = player.off_x - player.dx * step;                  // Calculate new X offset (backward)
+        float new_y = player.off_y - player.dy * step;                  // Calculate new Y offset (backward)
         
         // Check collision before moving (separate X and Y for wall sliding)
-        if (!check_collision(new_x, player.y)) {                        // Check X movement collision
-            player.x = new_x;                                           // Move in X direction if no collision
+        if (!check_collision(player.cell_x, player.cell_y, new_x, player.off_y)) { // Check X movement collision
+            player.off_x = new_x;                                       // Move in X direction if no collision
+            m_cell_normalize(&player.cell_x, &player.off_x);            // Crossed into neighbour cell
+        }
+        if (!check_collision(player.cell_x, player.cell_y, player.off_x, new_y)) { // Check Y movement collision
+            player.off_y = new_y;                                       // Move in Y direction if no collision
+            m_cell_normalize(&player.cell_y, &player.off_y);            // Crossed into neighbour cell
         }
-        if (!check_collision(player.x, new_y)) {                        // Check Y movement collision
-            player.y = new_y;                                           // Move in Y direction if no collision
+    }
+
+    // Security camera pans from side to side
+    sim_tick_count++;
+    float phase = 2.0f * PI * (sim_tick_count % (SIM_TICK_RATE * SECURITY_CAM_PERIOD)) / (SIM_TICK_RATE * SECURITY_CAM_PERIOD);
+    security_cam.angle = m_fix_ang(40.0f + SECURITY_CAM_SWEEP * sinf(phase));
+    security_cam.dx = cos(m_deg_to_rad(security_cam.angle));
+    security_cam.dy = -sin(m_deg_to_rad(security_cam.angle));
+}
+
+// Copy poses of all simulated entities
+static void sim_poses(SimPose *poses) {
+    const struct Player *entities[SIM_ENTITY_COUNT] = { &player, &security_cam };
+    for (int i = 0; i < SIM_ENTITY_COUNT; i++) {
+        poses[i] = (SimPose){ entities[i]->cell_x, entities[i]->cell_y, entities[i]->off_x, entities[i]->off_y,
+                              entities[i]->angle, entities[i]->pitch };
+    }
+}
+
+// Publish current poses together with poses from start of tick (caller holds sim_lock)
+static void sim_publish(const SimPose *prev) {
+    SimState *state = &sim_slots[sim_back];
+    memcpy(state->prev, prev, sizeof(state->prev));
+    sim_poses(state->cur);
+    state->time = SDL_GetPerformanceCounter();
+    sim_back = SDL_AtomicSet(&sim_middle, sim_back | SIM_FRESH) & ~SIM_FRESH; // Hand filled slot over, take old one back
+}
+
+// Publish poses changed outside of tick (teleport) without interpolating from old place (caller holds sim_lock)
+void sim_reset(void) {
+    SimPose now[SIM_ENTITY_COUNT];
+    sim_poses(now);
+    sim_publish(now);
+}
+
+// Simulation thread - fixed rate ticks, whatever frame rate renderer runs at
+static int sim_loop(void *data) {
+    (void)data;
+    const Uint64 period = SDL_GetPerformanceFrequency() / SIM_TICK_RATE; // Performance counter ticks per simulation tick
+    Uint64 next = SDL_GetPerformanceCounter();
+    while (SDL_AtomicGet(&sim_on)) {
+        SDL_LockMutex(sim_lock);
+        SimPose before[SIM_ENTITY_COUNT];
+        sim_poses(before);
+        sim_tick(SDL_AtomicGet(&sim_keys));
+        sim_publish(before);
+        SDL_UnlockMutex(sim_lock);
+
+        next += period;
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now < next) {
+            SDL_Delay((Uint32)((next - now) * 1000 / SDL_GetPerformanceFrequency()));
+        } else if (now - next > period * SIM_TICK_RATE) {
+            next = now;                                                 // Stalled for over a second - don't replay missed ticks
         }
     }
+    return 0;
+}
+
+// Start simulation thread, first state is published right away so renderer never sees empty buffer
+void sim_start(void) {
+    sim_lock = SDL_CreateMutex();
+    SDL_AtomicSet(&sim_middle, 2);
+    sim_back = 0;
+    sim_front = 1;
+    sim_reset();
+    SDL_AtomicSet(&sim_on, 1);
+    sim_thread = SDL_CreateThread(sim_loop, "simulation", NULL);
+    if (!sim_thread) {
+        printf("Simulation: can't start thread: %s\n", SDL_GetError());
+        SDL_AtomicSet(&sim_on, 0);
+    }
+}
+
+// Stop simulation thread
+void sim_stop(void) {
+    if (!sim_lock) return;
+    SDL_AtomicSet(&sim_on, 0);
+    if (sim_thread) SDL_WaitThread(sim_thread, NULL);
+    sim_thread = NULL;
+    SDL_DestroyMutex(sim_lock);
+    sim_lock = NULL;
+}
+
+// Set camera to pose between a (t = 0) and b (t = 1). Positions are cell-relative, so difference is exact on any map size
+static void sim_lerp_pose(const SimPose *a, const SimPose *b, float t, struct Player *out) {
+    float move_x = (b->cell_x - a->cell_x) * MAP_CELL_SIZE + b->off_x - a->off_x;
+    float move_y = (b->cell_y - a->cell_y) * MAP_CELL_SIZE + b->off_y - a->off_y;
+    float turn = b->angle - a->angle;
+    if (turn > 180) turn -= 360;                                        // Turn the short way around
+    if (turn < -180) turn += 360;
+    out->cell_x = a->cell_x;
+    out->cell_y = a->cell_y;
+    out->off_x = a->off_x + move_x * t;
+    out->off_y = a->off_y + move_y * t;
+    m_cell_normalize(&out->cell_x, &out->off_x);
+    m_cell_normalize(&out->cell_y, &out->off_y);
+    out->angle = m_fix_ang(a->angle + turn * t);
+    out->pitch = a->pitch + (b->pitch - a->pitch) * t;
+    out->dx = cos(m_deg_to_rad(out->angle));
+    out->dy = -sin(m_deg_to_rad(out->angle));
+}
+
+// Update view cameras from latest published state. Renderer runs up to one tick behind simulation, in exchange
+// motion is smooth at any frame rate. Returns true when visible camera moved since last frame
+bool sim_interpolate(void) {
+    if (SDL_AtomicGet(&sim_middle) & SIM_FRESH) {                       // Take newer state
+        sim_front = SDL_AtomicSet(&sim_middle, sim_front) & ~SIM_FRESH;
+    }
+    const SimState *state = &sim_slots[sim_front];
+    float t = (float)(SDL_GetPerformanceCounter() - state->time) * SIM_TICK_RATE / SDL_GetPerformanceFrequency();
+    if (t > 1.0f) t = 1.0f;                                             // Simulation is late - hold latest pose
+
+    struct Player old_player = view_player, old_cam = view_security_cam;
+    sim_lerp_pose(&state->prev[SIM_PLAYER], &state->cur[SIM_PLAYER], t, &view_player);
+    sim_lerp_pose(&state->prev[SIM_SECURITY_CAM], &state->cur[SIM_SECURITY_CAM], t, &view_security_cam);
+
+    bool moved = view_player.cell_x != old_player.cell_x || view_player.cell_y != old_player.cell_y ||
+                 view_player.off_x != old_player.off_x || view_player.off_y != old_player.off_y ||
+                 view_player.angle != old_player.angle || view_player.pitch != old_player.pitch;
+    if (pip_on && view_security_cam.angle != old_cam.angle) moved = true; // Security camera is seen only in picture-in-picture
+    return moved;
 }
 
 // Collision detection function - checks if position contains a wall
-bool check_collision(float x, float y) {
-    // Convert world coordinates to map grid coordinates
-    int mapX = (int)floor(x / MAP_CELL_SIZE);                           // Get map X coordinate
-    int mapY = (int)floor(y / MAP_CELL_SIZE);                           // Get map Y coordinate
+bool check_collision(int cell_x, int cell_y, float off_x, float off_y) {
+    if (scene_type == SCENE_TERRAIN) return false;                      // Terrain has no walls, player walks over hills
+    
+    // Offset may reach into neighbour cell
+    int mapX = cell_x + (int)floorf(off_x / MAP_CELL_SIZE);             // Get map X coordinate
+    int mapY = cell_y + (int)floorf(off_y / MAP_CELL_SIZE);             // Get map Y coordinate
     
     // Check if coordinates are outside map boundaries
     if (mapX < 0 || mapX >= MAPX || mapY < 0 || mapY >= MAPY) {
@@ -855,4 +2327,1773 @@ bool check_collision(float x, float y) {
     }
     
     return false;                                                       // No collision detected
-}
\ No newline at end of file
+}
+// Read next number from .ppm header or ASCII body, skipping whitespace and # comments
+static int a_read_ppm_number(FILE *file, int *value) {
+    int c;
+    while ((c = fgetc(file)) != EOF) {                                  // Skip whitespace and comment lines
+        if (c == '#') {
+            while ((c = fgetc(file)) != EOF && c != '\n');             // Skip rest of comment line
+        } else if (!isspace(c)) {
+            ungetc(c, file);                                            // Put back first digit
+            return fscanf(file, "%d", value) == 1;                      // Parse the number
+        }
+    }
+    return 0;                                                           // End of file reached
+}
+
+// Load .ppm image (ASCII P3 exported by GIMP or binary P6) into new ARGB buffer, returns NULL on error
+uint32_t* a_load_ppm(const char *path, int width, int height) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;                                             // File vanished or is not readable
+
+    // Check image header - format, size and max color value
+    char magic[3] = {0};
+    int w = 0, h = 0, maxval = 0;
+    if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P' || (magic[1] != '3' && magic[1] != '6') ||
+        !a_read_ppm_number(file, &w) || !a_read_ppm_number(file, &h) || !a_read_ppm_number(file, &maxval) ||
+        w != width || h != height || maxval <= 0 || maxval > 255) {
+        printf("Asset hot-reload: '%s' is not a %dx%d 8-bit .ppm image, skipping\n", path, width, height);
+        fclose(file);
+        return NULL;
+    }
+    if (magic[1] == '6') fgetc(file);                                   // Single whitespace separates P6 header from data
+
+    uint32_t *buffer = malloc(width * height * sizeof(uint32_t));       // New pixel buffer for asset
+    if (!buffer) {
+        fclose(file);
+        return NULL;
+    }
+
+    // Read RGB triplets and pack them to ARGB
+    for (int i = 0; i < width * height; i++) {
+        int rgb[3];
+        for (int c = 0; c < 3; c++) {
+            if (magic[1] == '6') rgb[c] = fgetc(file);                  // Binary sample
+            else if (!a_read_ppm_number(file, &rgb[c])) rgb[c] = EOF;   // ASCII sample
+            if (rgb[c] == EOF) {                                        // File is truncated (maybe still being written)
+                printf("Asset hot-reload: '%s' is truncated, skipping\n", path);
+                free(buffer);
+                fclose(file);
+                return NULL;
+            }
+            rgb[c] = rgb[c] * 255 / maxval;                             // Scale to 0-255 range
+        }
+        buffer[i] = 0xFF000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+    }
+
+    fclose(file);
+    a_premultiply(buffer, width * height);                              // Magenta of .ppm source is transparent
+    return buffer;
+}
+
+#ifdef __linux__
+// Watcher thread - waits for changed .ppm files and imports them in the background
+static int a_watch_loop(void *data) {
+    int fd = (int)(intptr_t)data;                                       // inotify descriptor
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event)))); // Event buffer
+
+    while (SDL_AtomicGet(&asset_watch_on)) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 250) <= 0) continue;                          // Wake up regularly to check run flag
+
+        ssize_t len = read(fd, events, sizeof(events));
+        for (char *p = events; len > 0 && p < events + len; ) {         // Walk through all events in buffer
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0) continue;
+
+            // Find asset matching the changed file name (name.ppm)
+            for (int id = 0; id < ASSET_COUNT; id++) {
+                size_t name_len = strlen(asset_info[id].name);
+                if (strncmp(event->name, asset_info[id].name, name_len) != 0 || strcmp(event->name + name_len, ".ppm") != 0) {
+                    continue;
+                }
+
+                char path[512];
+                snprintf(path, sizeof(path), "%s/%s", ASSET_SOURCE_DIR, event->name);
+                uint32_t *buffer = a_load_ppm(path, asset_info[id].width, asset_info[id].height);
+                if (buffer) {
+                    free(SDL_AtomicSetPtr(&asset_pending[id], buffer)); // Hand over, replacing not yet applied import
+                    printf("Asset hot-reload: reimported '%s'\n", asset_info[id].name);
+                }
+                break;
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+#endif
+
+// Start watching asset source directory, hot-reload stays off when directory doesn't exist
+void a_hotreload_start(void) {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);                   // Non-blocking, poll() does the waiting
+    if (fd < 0) return;
+    if (inotify_add_watch(fd, ASSET_SOURCE_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);                                                      // No asset sources in working directory
+        return;
+    }
+
+    SDL_AtomicSet(&asset_watch_on, 1);
+    asset_watch_thread = SDL_CreateThread(a_watch_loop, "asset_watch", (void *)(intptr_t)fd);
+    if (!asset_watch_thread) {
+        close(fd);
+        return;
+    }
+    printf("Asset hot-reload: watching '%s'\n", ASSET_SOURCE_DIR);
+#endif
+}
+
+// Stop watcher thread and release all reloaded asset buffers
+void a_hotreload_stop(void) {
+    if (asset_watch_thread) {
+        SDL_AtomicSet(&asset_watch_on, 0);                              // Ask watcher to quit
+        SDL_WaitThread(asset_watch_thread, NULL);
+        a_apply_reloads();                                              // Move pending buffers to loaded list
+        asset_watch_thread = NULL;
+    }
+
+    a_free_assets();
+}
+
+// Free asset buffers owned by engine (reloaded or converted assets), compiled-in arrays stay in asset table
+void a_free_assets(void) {
+    for (int id = 0; id < ASSET_COUNT; id++) {
+        free(asset_loaded[id]);
+        asset_loaded[id] = NULL;
+    }
+}
+
+// Convert legacy colour key to alpha - magenta texels become fully transparent (premultiplied zero). Images from
+// current converter carry premultiplied alpha already and pass unchanged
+void a_premultiply(uint32_t *buffer, int count) {
+    for (int i = 0; i < count; i++) {
+        if (buffer[i] == 0xFFFF00FF) buffer[i] = 0x00000000;
+    }
+}
+
+// Compiled-in assets made by older converter use magenta colour key - renderer blends premultiplied alpha only,
+// so such assets are replaced by converted copies once at startup
+void a_prepare_assets(void) {
+    for (int id = 0; id < ASSET_COUNT; id++) {
+        int count = asset_info[id].width * asset_info[id].height;
+        const uint32_t *pixels_in = asset_pixels[id];
+        int i = 0;
+        while (i < count && pixels_in[i] != 0xFFFF00FF) i++;            // Look for colour key
+        if (i == count) continue;                                       // Opaque or converted already
+
+        uint32_t *buffer = malloc(count * sizeof(uint32_t));
+        if (!buffer) continue;                                          // Keyed texels stay visible as magenta
+        memcpy(buffer, pixels_in, count * sizeof(uint32_t));
+        a_premultiply(buffer, count);
+        asset_loaded[id] = buffer;
+        asset_pixels[id] = buffer;
+    }
+}
+
+// Swap freshly imported assets into asset table - called between frames, so no frame sees half of a swap
+void a_apply_reloads(void) {
+    if (!asset_watch_thread) return;                                    // Hot-reload is not active
+
+    for (int id = 0; id < ASSET_COUNT; id++) {
+        uint32_t *buffer = SDL_AtomicSetPtr(&asset_pending[id], NULL);  // Take pending buffer (if any)
+        if (!buffer) continue;
+
+        free(asset_loaded[id]);                                         // Previous reload is no longer referenced
+        asset_loaded[id] = buffer;
+        asset_pixels[id] = buffer;                                      // Engine picks new pixels up from asset table
+        scene_generation++;                                             // Frame has to be redrawn with new asset
+    }
+}
+
+// Convert row of ARGB pixels to Y, U and V planes (BT.601 full range, 8-bit fixed point)
+static void v_argb_to_yuv(const uint32_t *src, uint8_t *y, uint8_t *u, uint8_t *v, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    // 4 pixels per iteration, all channel math in 32-bit lanes
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128i bias = _mm_set1_epi32(128 << 8);
+    for (; i + 4 <= count; i += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i *)(src + i));      // Load 4 ARGB pixels
+        __m128i r = _mm_and_si128(_mm_srli_epi32(px, 16), mask);        // Split to channels
+        __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+        __m128i b = _mm_and_si128(px, mask);
+
+        // Products fit to 16 bits, so 16-bit multiply of zero-extended lanes gives exact 32-bit results
+        __m128i yy = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(77)),
+                                                 _mm_mullo_epi16(g, _mm_set1_epi32(150))),
+                                   _mm_mullo_epi16(b, _mm_set1_epi32(29)));
+        __m128i uu = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(b, 7), bias),
+                                   _mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(43)), _mm_mullo_epi16(g, _mm_set1_epi32(85))));
+        __m128i vv = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(r, 7), bias),
+                                   _mm_add_epi32(_mm_mullo_epi16(g, _mm_set1_epi32(107)), _mm_mullo_epi16(b, _mm_set1_epi32(21))));
+
+        // Scale back to 8 bits and pack 4 lanes to 4 bytes
+        yy = _mm_packus_epi16(_mm_packs_epi32(_mm_srli_epi32(yy, 8), yy), yy);
+        uu = _mm_packus_epi16(_mm_packs_epi32(_mm_srli_epi32(uu, 8), uu), uu);
+        vv = _mm_packus_epi16(_mm_packs_epi32(_mm_srli_epi32(vv, 8), vv), vv);
+        uint32_t y4 = _mm_cvtsi128_si32(yy), u4 = _mm_cvtsi128_si32(uu), v4 = _mm_cvtsi128_si32(vv);
+        memcpy(y + i, &y4, 4);
+        memcpy(u + i, &u4, 4);
+        memcpy(v + i, &v4, 4);
+    }
+#endif
+    // Scalar tail (or whole row without SSE2)
+    for (; i < count; i++) {
+        int r = (src[i] >> 16) & 0xFF, g = (src[i] >> 8) & 0xFF, b = src[i] & 0xFF;
+        y[i] = (77 * r + 150 * g + 29 * b) >> 8;
+        u[i] = ((128 << 8) + 128 * b - 43 * r - 85 * g) >> 8;
+        v[i] = ((128 << 8) + 128 * r - 107 * g - 21 * b) >> 8;
+    }
+}
+
+// Writer thread - converts pushed frames and writes them out, runs until stopped and ring is drained
+static int v_capture_loop(void *data) {
+    (void)data;                                                         // Writer uses global capture state
+    const int frame_pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    uint8_t *planes = capture_planes;
+
+    while (true) {
+        SDL_SemWait(capture_ready);                                     // Sleep until frame is pushed (or stop is requested)
+        int tail = SDL_AtomicGet(&capture_tail);
+        if (tail == SDL_AtomicGet(&capture_head)) {                     // Nothing to write
+            if (!SDL_AtomicGet(&capture_on)) break;                     // Stop requested and ring is drained
+            continue;
+        }
+
+        const uint32_t *frame = capture_ring[tail % CAPTURE_RING_SIZE];
+        if (capture_y4m) {
+            fputs("FRAME\n", capture_file);
+            v_argb_to_yuv(frame, planes, planes + frame_pixels, planes + 2 * frame_pixels, frame_pixels);
+            fwrite(planes, 1, frame_pixels * 3, capture_file);
+        } else {
+            fwrite(frame, sizeof(uint32_t), frame_pixels, capture_file); // Raw frame as it is in memory
+        }
+        SDL_AtomicAdd(&capture_tail, 1);                                // Slot is free again
+    }
+    return 0;
+}
+
+// Close capture file and free ring, plane buffer and semaphore (writer thread must not run)
+static void v_capture_release(void) {
+    fclose(capture_file);
+    capture_file = NULL;
+    if (capture_ready) SDL_DestroySemaphore(capture_ready);
+    capture_ready = NULL;
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+        free(capture_ring[i]);
+        capture_ring[i] = NULL;
+    }
+    free(capture_planes);
+    capture_planes = NULL;
+}
+
+// Start recording frames to file, returns false when recording couldn't be started
+bool v_capture_start(const char *path, bool y4m) {
+    if (capture_thread) return false;                                   // Already recording
+
+    capture_file = fopen(path, "wb");
+    if (!capture_file) {
+        printf("Capture: cannot create '%s'\n", path);
+        return false;
+    }
+    setvbuf(capture_file, NULL, _IOFBF, CAPTURE_IO_BUFFER);             // Large buffer = few big sequential writes
+    if (y4m) {
+        fprintf(capture_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT, CAPTURE_FPS);
+    }
+
+    // Preallocate whole ring, so game loop never allocates while recording
+    bool ok = true;
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+        capture_ring[i] = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+        if (!capture_ring[i]) ok = false;
+    }
+    if (y4m) {
+        capture_planes = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+        if (!capture_planes) ok = false;
+    }
+    capture_ready = ok ? SDL_CreateSemaphore(0) : NULL;
+    if (!capture_ready) {
+        printf("Capture: out of memory\n");
+        v_capture_release();
+        return false;
+    }
+
+    SDL_AtomicSet(&capture_head, 0);
+    SDL_AtomicSet(&capture_tail, 0);
+    SDL_AtomicSet(&capture_on, 1);
+    capture_y4m = y4m;
+    capture_dropped = 0;
+    capture_thread = SDL_CreateThread(v_capture_loop, "capture", NULL);
+    if (!capture_thread) {
+        printf("Capture: cannot start writer thread\n");
+        SDL_AtomicSet(&capture_on, 0);
+        v_capture_release();
+        return false;
+    }
+    printf("Capture: recording to '%s'\n", path);
+    return true;
+}
+
+// Stop recording - writer finishes frames already in ring before file is closed
+void v_capture_stop(void) {
+    if (!capture_thread) return;                                        // Not recording
+
+    SDL_AtomicSet(&capture_on, 0);
+    SDL_SemPost(capture_ready);                                         // Wake writer so it notices stop request
+    SDL_WaitThread(capture_thread, NULL);
+    capture_thread = NULL;
+
+    printf("Capture: %d frames written, %d dropped\n", SDL_AtomicGet(&capture_tail), capture_dropped);
+    v_capture_release();
+}
+
+// Hand finished frame to writer thread - never waits, frame is dropped when all ring slots are taken
+void v_capture_frame(const uint32_t *frame) {
+    int head = SDL_AtomicGet(&capture_head);
+    if (head - SDL_AtomicGet(&capture_tail) >= CAPTURE_RING_SIZE) {     // Writer is behind, don't stall game loop
+        capture_dropped++;
+        return;
+    }
+
+    memcpy(capture_ring[head % CAPTURE_RING_SIZE], frame, SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    SDL_AtomicAdd(&capture_head, 1);                                    // Publish frame (full memory barrier)
+    SDL_SemPost(capture_ready);
+}
+
+// Worker thread - processes items of active batches until pool is shut down
+static int jobs_worker(void *data) {
+    (void)data;
+    SDL_LockMutex(job_lock);
+    while (!job_quit) {
+        // Find batch which still has unclaimed items
+        JobBatch *batch = job_active;
+        while (batch && SDL_AtomicGet(&batch->next) >= batch->count) batch = batch->next_batch;
+        if (!batch) {
+            SDL_CondWait(job_wake, job_lock);                           // Sleep until new batch arrives
+            continue;
+        }
+
+        batch->users++;                                                 // Batch must stay alive while we claim items
+        SDL_UnlockMutex(job_lock);
+        int index;
+        while ((index = SDL_AtomicAdd(&batch->next, 1)) < batch->count) {
+            batch->func(batch->data, index);
+            SDL_AtomicAdd(&batch->done, 1);
+        }
+        SDL_LockMutex(job_lock);
+        batch->users--;
+        SDL_CondBroadcast(job_finished);                                // Caller may be waiting for last item
+    }
+    SDL_UnlockMutex(job_lock);
+    return 0;
+}
+
+// Start worker pool with given number of threads (calling thread always works too)
+void jobs_init(int threads) {
+    if (job_thread_count > 0) return;                                   // Pool already running
+    if (threads > MAX_WORKERS) threads = MAX_WORKERS;
+
+    job_lock = SDL_CreateMutex();
+    job_wake = SDL_CreateCond();
+    job_finished = SDL_CreateCond();
+    job_quit = false;
+    for (int i = 0; i < threads; i++) {
+        job_threads[job_thread_count] = SDL_CreateThread(jobs_worker, "worker", NULL);
+        if (job_threads[job_thread_count]) job_thread_count++;
+    }
+}
+
+// Stop all workers (no batch may be running)
+void jobs_shutdown(void) {
+    if (!job_lock) return;
+
+    SDL_LockMutex(job_lock);
+    job_quit = true;
+    SDL_CondBroadcast(job_wake);
+    SDL_UnlockMutex(job_lock);
+    for (int i = 0; i < job_thread_count; i++) {
+        SDL_WaitThread(job_threads[i], NULL);
+    }
+    job_thread_count = 0;
+
+    SDL_DestroyCond(job_finished);
+    SDL_DestroyCond(job_wake);
+    SDL_DestroyMutex(job_lock);
+    job_lock = NULL;
+}
+
+// Run func for items 0..count-1 on worker pool and wait until all are done. Can be called from inside job (nested batch)
+void jobs_run(JobFunc func, void *data, int count) {
+    if (job_thread_count == 0 || count <= 1) {                          // No pool or nothing to share - run here
+        for (int i = 0; i < count; i++) func(data, i);
+        return;
+    }
+
+    JobBatch batch = { .func = func, .data = data, .count = count };
+    SDL_LockMutex(job_lock);
+    batch.next_batch = job_active;                                      // Push batch to active list
+    job_active = &batch;
+    SDL_CondBroadcast(job_wake);
+    SDL_UnlockMutex(job_lock);
+
+    // Caller works on its own batch as well
+    int index;
+    while ((index = SDL_AtomicAdd(&batch.next, 1)) < count) {
+        func(data, index);
+        SDL_AtomicAdd(&batch.done, 1);
+    }
+
+    // Wait for items claimed by workers, then unlink batch
+    SDL_LockMutex(job_lock);
+    while (SDL_AtomicGet(&batch.done) < count || batch.users > 0) {
+        SDL_CondWait(job_finished, job_lock);
+    }
+    JobBatch **link = &job_active;
+    while (*link != &batch) link = &(*link)->next_batch;
+    *link = batch.next_batch;
+    SDL_UnlockMutex(job_lock);
+}
+
+// One wave of frame job graph - ready stages run as one worker pool batch
+typedef struct {
+    FrameStage *stages;                                                 // All stages of graph
+    int ids[MAX_FRAME_STAGES];                                          // Stages of this wave
+    uint32_t *target;                                                   // Framebuffer of calling thread
+    Viewport viewport;                                                  // Viewport of calling thread (restored after wave)
+} StageWave;
+
+// Stage job - runs stage on caller framebuffer and times it
+static void stages_job(void *data, int index) {
+    StageWave *wave = data;
+    FrameStage *stage = &wave->stages[wave->ids[index]];
+    pixels = wave->target;                                              // Stages may run on worker threads
+    viewport = stage->region;                                           // Stage draws only into its own region
+    Uint64 start = SDL_GetPerformanceCounter();
+    stage->run();
+    stage->us = metrics_since(start);
+    if (stage->metric >= 0) metrics_add(stage->metric, (int)stage->us);
+}
+
+static bool stages_overlap(const Viewport *a, const Viewport *b) {
+    return a->x < b->x + b->width && b->x < a->x + a->width && a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+// Run frame job graph in waves of ready stages. Returns critical path - longest chain of dependent stage times,
+// which is frame time with enough cores (difference to frame time shows waiting for cores or for slow stage)
+Uint64 stages_run(FrameStage *stages, int count) {
+    uint32_t done = 0, all = (1u << count) - 1;
+    Uint64 finish[MAX_FRAME_STAGES];                                    // Critical path up to end of stage
+    Uint64 critical = 0;
+    while (done != all) {
+        StageWave wave = { .stages = stages, .target = pixels, .viewport = viewport };
+        int wave_count = 0;
+        for (int i = 0; i < count; i++) {
+            if ((done >> i & 1) || (stages[i].deps & ~done)) continue;  // Finished or still waiting
+            bool overlap = false;
+            for (int k = 0; k < wave_count; k++) overlap |= stages_overlap(&stages[i].region, &stages[wave.ids[k]].region);
+            if (!overlap) wave.ids[wave_count++] = i;
+        }
+        if (wave_count == 0) {                                          // Dependency cycle - stages can never run
+            fprintf(stderr, "Frame stages: dependency cycle\n");
+            break;
+        }
+        jobs_run(stages_job, &wave, wave_count);
+        pixels = wave.target;                                           // Calling thread ran stages too
+        viewport = wave.viewport;
+
+        for (int k = 0; k < wave_count; k++) {
+            int i = wave.ids[k];
+            Uint64 before = 0;                                          // Longest chain of dependencies
+            for (int d = 0; d < count; d++) {
+                if ((stages[i].deps >> d & 1) && finish[d] > before) before = finish[d];
+            }
+            finish[i] = before + stages[i].us;
+            if (finish[i] > critical) critical = finish[i];
+            done |= 1u << i;
+        }
+    }
+    return critical;
+}
+
+// Batch rendering state shared by render jobs and image writer thread
+typedef struct {
+    struct Player *poses;                                               // Camera poses to render
+    int count;                                                          // Number of poses
+    const char *out_dir;                                                // Output directory for images
+    uint32_t **free_buffers;                                            // Framebuffers ready for rendering
+    int free_count;                                                     // Number of free framebuffers
+    uint32_t **done_buffers;                                            // Rendered framebuffers waiting for writer (FIFO)
+    int *done_index;                                                    // Pose index of each rendered framebuffer
+    int done_head, done_tail;                                           // Done queue read and write positions
+    int queue_size;                                                     // Capacity of done queue (= number of framebuffers)
+    int written;                                                        // Images written by writer
+    SDL_mutex *lock;                                                    // Protects buffer lists and queue
+    SDL_cond *changed;                                                  // Signals buffer freed or frame rendered
+} BatchState;
+
+// Render job - renders one pose into free framebuffer and queues it for writing
+static void batch_render_job(void *data, int index) {
+    BatchState *batch = data;
+
+    SDL_LockMutex(batch->lock);
+    while (batch->free_count == 0) SDL_CondWait(batch->changed, batch->lock); // Writer is behind, wait for buffer
+    uint32_t *buffer = batch->free_buffers[--batch->free_count];
+    SDL_UnlockMutex(batch->lock);
+
+    pixels = buffer;                                                    // Render into our own framebuffer
+    Uint64 frame_start = SDL_GetPerformanceCounter();
+    r_clearscreenbuffer();
+    r_render_scene(&batch->poses[index]);
+    metrics_frame(frame_start);
+
+    SDL_LockMutex(batch->lock);
+    batch->done_buffers[batch->done_tail % batch->queue_size] = buffer;
+    batch->done_index[batch->done_tail % batch->queue_size] = index;
+    batch->done_tail++;
+    SDL_CondBroadcast(batch->changed);
+    SDL_UnlockMutex(batch->lock);
+}
+
+// Writer thread - writes 3D viewport of rendered frames as binary .ppm images
+static int batch_writer(void *data) {
+    BatchState *batch = data;
+    const int vp_left = 512;                                            // Left edge of 3D viewport
+    const int vp_width = SCREEN_WIDTH - vp_left;
+    uint8_t *rgb = malloc(vp_width * SCREEN_HEIGHT * 3);                // One image in file format
+
+    while (batch->written < batch->count) {
+        SDL_LockMutex(batch->lock);
+        while (batch->done_head == batch->done_tail) SDL_CondWait(batch->changed, batch->lock);
+        uint32_t *buffer = batch->done_buffers[batch->done_head % batch->queue_size];
+        int index = batch->done_index[batch->done_head % batch->queue_size];
+        batch->done_head++;
+        SDL_UnlockMutex(batch->lock);
+
+        // Convert viewport to packed RGB
+        uint8_t *out = rgb;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            const uint32_t *row = buffer + y * SCREEN_WIDTH + vp_left;
+            for (int x = 0; x < vp_width; x++) {
+                *out++ = row[x] >> 16;
+                *out++ = row[x] >> 8;
+                *out++ = row[x];
+            }
+        }
+
+        // Framebuffer is not needed anymore, give it back to render jobs
+        SDL_LockMutex(batch->lock);
+        batch->free_buffers[batch->free_count++] = buffer;
+        SDL_CondBroadcast(batch->changed);
+        SDL_UnlockMutex(batch->lock);
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/frame_%06d.ppm", batch->out_dir, index);
+        FILE *file = fopen(path, "wb");
+        if (file) {
+            fprintf(file, "P6\n%d %d\n255\n", vp_width, SCREEN_HEIGHT);
+            fwrite(rgb, 1, vp_width * SCREEN_HEIGHT * 3, file);
+            fclose(file);
+        } else {
+            printf("Batch: cannot write '%s'\n", path);
+        }
+        batch->written++;
+    }
+
+    free(rgb);
+    return 0;
+}
+
+// Headless rendering of camera pose list (lines "x y angle [pitch]") to images in output directory
+int batch_render(const char *pose_file, const char *out_dir) {
+    FILE *file = fopen(pose_file, "r");
+    if (!file) {
+        printf("Batch: cannot open pose file '%s'\n", pose_file);
+        return -1;
+    }
+
+    // Read all poses
+    BatchState batch = { .out_dir = out_dir };
+    int capacity = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        struct Player pose = {0};
+        double x, y;                                                    // World position (double keeps precision on huge maps)
+        int fields = sscanf(line, "%lf %lf %f %f", &x, &y, &pose.angle, &pose.pitch);
+        if (fields < 3) continue;                                       // Skip empty lines and comments
+        m_set_world_pos(&pose, x, y);
+        pose.angle = m_fix_ang(pose.angle);
+        pose.dx = cos(m_deg_to_rad(pose.angle));                        // Direction vector like in process_inputs()
+        pose.dy = -sin(m_deg_to_rad(pose.angle));
+
+        if (batch.count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            batch.poses = realloc(batch.poses, capacity * sizeof(struct Player));
+        }
+        batch.poses[batch.count++] = pose;
+    }
+    fclose(file);
+    if (batch.count == 0) {
+        printf("Batch: no poses in '%s'\n", pose_file);
+        free(batch.poses);
+        return -1;
+    }
+
+    // Start workers and allocate framebuffers, map and assets are shared read-only by all of them
+    SDL_Init(0);
+    int threads = SDL_GetCPUCount();
+    if (threads > MAX_WORKERS) threads = MAX_WORKERS;
+    jobs_init(threads - 1);                                             // Calling thread is worker too
+    batch.queue_size = threads * BATCH_BUFFERS_PER_WORKER;
+    batch.free_buffers = malloc(batch.queue_size * sizeof(uint32_t *));
+    batch.done_buffers = malloc(batch.queue_size * sizeof(uint32_t *));
+    batch.done_index = malloc(batch.queue_size * sizeof(int));
+    for (int i = 0; i < batch.queue_size; i++) {
+        batch.free_buffers[batch.free_count++] = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    }
+    batch.lock = SDL_CreateMutex();
+    batch.changed = SDL_CreateCond();
+
+    // Render everything, images are written by separate thread while rendering continues
+    Uint64 start = SDL_GetPerformanceCounter();
+    SDL_Thread *writer = SDL_CreateThread(batch_writer, "batch_writer", &batch);
+    jobs_run(batch_render_job, &batch, batch.count);
+    SDL_WaitThread(writer, NULL);
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    printf("Batch: %d images in %.2f s (%.1f images/s, %d threads)\n", batch.count, seconds, batch.count / seconds, threads);
+
+    // Cleanup
+    jobs_shutdown();
+    SDL_DestroyCond(batch.changed);
+    SDL_DestroyMutex(batch.lock);
+    for (int i = 0; i < batch.free_count; i++) free(batch.free_buffers[i]);
+    free(batch.free_buffers);
+    free(batch.done_buffers);
+    free(batch.done_index);
+    free(batch.poses);
+    SDL_Quit();
+    return 0;
+}
+
+#ifdef __linux__
+// Connected render service client
+typedef struct {
+    int fd;                                                             // Client socket (-1 = free entry)
+    uint32_t *frames;                                                   // Shared memory ring of slots
+    int next_slot;                                                      // Next ring slot to render into
+    RenderReply reply;                                                  // Reply to request being rendered
+    bool pending;                                                       // Reply has to be sent after current batch
+} ServiceClient;
+
+// One frame of render service batch
+typedef struct {
+    struct Player cam;                                                  // Camera to render
+    uint32_t *target;                                                   // Ring slot in client shared memory
+} ServiceJob;
+
+ServiceClient service_clients[SERVICE_MAX_CLIENTS];                     // Client table
+
+// Ctrl+C handler - ends service loop
+static void service_stop(int signal_number) {
+    (void)signal_number;
+    engine_on = false;
+}
+
+// Accept new client, create its frame ring and send it over together with hello message
+static void service_accept(int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+
+    ServiceClient *client = NULL;
+    for (int i = 0; i < SERVICE_MAX_CLIENTS && !client; i++) {
+        if (service_clients[i].fd < 0) client = &service_clients[i];
+    }
+
+    ServiceHello hello = { SCREEN_WIDTH, SCREEN_HEIGHT, SERVICE_RING_SLOTS, SERVICE_SLOT_SIZE, SCREEN_WIDTH * SCREEN_HEIGHT * 4 };
+    size_t ring_size = (size_t)hello.slots * hello.slot_size;
+    int memfd = client ? memfd_create("raycast_frames", MFD_CLOEXEC) : -1;
+    void *frames = MAP_FAILED;
+    if (memfd >= 0 && ftruncate(memfd, ring_size) == 0) {
+        frames = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (frames == MAP_FAILED) {                                         // Client table full or out of memory
+        printf("Service: rejecting client\n");
+        if (memfd >= 0) close(memfd);
+        close(fd);
+        return;
+    }
+
+    // Hello message carries shared memory descriptor as ancillary data
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    bool sent = sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(hello);
+    close(memfd);                                                       // Mapping keeps shared memory alive
+    if (!sent) {
+        munmap(frames, ring_size);
+        close(fd);
+        return;
+    }
+
+    client->fd = fd;
+    client->frames = frames;
+    client->next_slot = 0;
+    client->pending = false;
+    printf("Service: client connected\n");
+}
+
+// Disconnect client and release its frame ring
+static void service_drop(ServiceClient *client) {
+    munmap(client->frames, (size_t)SERVICE_RING_SLOTS * SERVICE_SLOT_SIZE);
+    close(client->fd);
+    client->fd = -1;
+    client->frames = NULL;
+    printf("Service: client disconnected\n");
+}
+
+// Render service - answers render requests of local clients until interrupted
+int service_run(const char *socket_path) {
+    int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);                                                // Remove stale socket of previous run
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, SERVICE_MAX_CLIENTS) != 0) {
+        printf("Service: cannot listen on '%s'\n", socket_path);
+        if (listen_fd >= 0) close(listen_fd);
+        return -1;
+    }
+
+    SDL_Init(0);
+    int threads = SDL_GetCPUCount();
+    jobs_init(threads - 1);                                             // Calling thread is worker too
+    signal(SIGINT, service_stop);
+    signal(SIGTERM, service_stop);
+    for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) service_clients[i].fd = -1;
+    ServiceJob *jobs = malloc(SERVICE_MAX_CLIENTS * SERVICE_RING_SLOTS * sizeof(ServiceJob));
+    View *views = malloc(SERVICE_MAX_CLIENTS * SERVICE_RING_SLOTS * sizeof(View));
+    if (!quicksave_valid) {                                             // Reset requests return to state at start
+        snapshot_save(&quicksave);
+        quicksave_valid = true;
+    }
+    printf("Service: listening on '%s' (%d threads)\n", socket_path, threads);
+
+    while (engine_on) {
+        // Wait for new clients and requests
+        struct pollfd fds[SERVICE_MAX_CLIENTS + 1];
+        int owners[SERVICE_MAX_CLIENTS + 1];                            // Client index of every polled descriptor
+        int nfds = 0;
+        fds[nfds++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+            if (service_clients[i].fd < 0) continue;
+            owners[nfds] = i;
+            fds[nfds++] = (struct pollfd){ .fd = service_clients[i].fd, .events = POLLIN };
+        }
+        if (poll(fds, nfds, -1) <= 0) continue;                         // Interrupted (maybe by Ctrl+C)
+
+        if (fds[0].revents & POLLIN) service_accept(listen_fd);
+
+        // Collect requests of all ready clients into one batch
+        int job_count = 0;
+        for (int f = 1; f < nfds; f++) {
+            if (!fds[f].revents) continue;
+            ServiceClient *client = &service_clients[owners[f]];
+
+            RenderRequest request;
+            ssize_t len = recv(client->fd, &request, sizeof(request), 0);
+            if (len <= 0 || len < (ssize_t)sizeof(uint32_t) || request.count > SERVICE_RING_SLOTS ||
+                len < (ssize_t)(sizeof(uint32_t) + request.count * sizeof(RenderPose))) {
+                service_drop(client);                                   // Disconnected or broken request
+                continue;
+            }
+
+            if (request.count == 0) snapshot_restore(&quicksave);      // Episode reset (shared world of all clients)
+            client->reply.count = request.count;
+            for (uint32_t i = 0; i < request.count; i++) {
+                ServiceJob *job = &jobs[job_count++];
+                RenderPose *pose = &request.poses[i];
+                job->cam = (struct Player){ .angle = m_fix_ang(pose->angle), .pitch = pose->pitch };
+                m_set_world_pos(&job->cam, pose->x, pose->y);
+                job->cam.dx = cos(m_deg_to_rad(job->cam.angle));
+                job->cam.dy = -sin(m_deg_to_rad(job->cam.angle));
+                job->target = client->frames + (size_t)client->next_slot * SERVICE_SLOT_SIZE / 4;
+                client->reply.slots[i] = client->next_slot;
+                client->next_slot = (client->next_slot + 1) % SERVICE_RING_SLOTS;
+            }
+            client->pending = true;                                     // Answer after batch is rendered
+        }
+
+        // Render whole batch as views of one frame directly into shared memory, then answer every client
+        for (int i = 0; i < job_count; i++) {
+            views[i] = (View){ .cam = &jobs[i].cam, .target = jobs[i].target, .rect = viewport, .frame = true,
+                               .object_ids = jobs[i].target + SCREEN_WIDTH * SCREEN_HEIGHT }; // Segmentation follows frame in slot
+        }
+        r_render_views(views, job_count);
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+            ServiceClient *client = &service_clients[i];
+            if (client->fd < 0 || !client->pending) continue;
+            client->pending = false;
+            if (send(client->fd, &client->reply, sizeof(uint32_t) + client->reply.count * sizeof(uint32_t), MSG_NOSIGNAL) < 0) {
+                service_drop(client);
+            }
+        }
+    }
+
+    // Shutdown
+    for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+        if (service_clients[i].fd >= 0) service_drop(&service_clients[i]);
+    }
+    free(jobs);
+    free(views);
+    jobs_shutdown();
+    close(listen_fd);
+    unlink(socket_path);
+    SDL_Quit();
+    printf("Service: stopped\n");
+    return 0;
+}
+#else
+// Render service depends on Unix sockets and shared memory
+int service_run(const char *socket_path) {
+    (void)socket_path;
+    printf("Service: render service is available only on Linux\n");
+    return -1;
+}
+#endif
+
+// Copy camera pose into snapshot
+static void snapshot_pose_save(SnapshotPose *pose, const struct Player *cam) {
+    *pose = (SnapshotPose){ cam->cell_x, cam->cell_y, cam->off_x, cam->off_y, cam->dx, cam->dy, cam->angle, cam->pitch };
+}
+
+// Copy camera pose from snapshot
+static void snapshot_pose_restore(const SnapshotPose *pose, struct Player *cam) {
+    cam->cell_x = pose->cell_x;
+    cam->cell_y = pose->cell_y;
+    cam->off_x = pose->off_x;
+    cam->off_y = pose->off_y;
+    cam->dx = pose->dx;
+    cam->dy = pose->dy;
+    cam->angle = pose->angle;
+    cam->pitch = pose->pitch;
+}
+
+// Capture engine state into snapshot (fixed size, no allocation - cheap enough to call every episode)
+void snapshot_save(Snapshot *snap) {
+    snap->magic = SNAPSHOT_MAGIC;
+    snap->version = SNAPSHOT_VERSION;
+    snapshot_pose_save(&snap->player, &player);
+    snapshot_pose_save(&snap->security_cam, &security_cam);
+    snap->sim_tick_count = sim_tick_count;
+    memcpy(snap->map, map, sizeof(map));
+    memcpy(snap->map_sprites, map_sprites, sizeof(map_sprites));
+    memcpy(snap->decal_faces, decal_faces, sizeof(decal_faces));
+    memcpy(snap->decal_count, decal_count, sizeof(decal_count));
+    snap->decal_clock = decal_clock;
+    snap->particles = particles;
+    snap->particles_seed = particles_seed;
+}
+
+// Reset engine state from snapshot - memcpy-level cost (caller holds sim_lock while simulation thread runs)
+void snapshot_restore(const Snapshot *snap) {
+    snapshot_pose_restore(&snap->player, &player);
+    snapshot_pose_restore(&snap->security_cam, &security_cam);
+    sim_tick_count = snap->sim_tick_count;
+    memcpy(map, snap->map, sizeof(map));
+    memcpy(map_sprites, snap->map_sprites, sizeof(map_sprites));
+    memcpy(decal_faces, snap->decal_faces, sizeof(decal_faces));
+    memcpy(decal_count, snap->decal_count, sizeof(decal_count));
+    decal_clock = snap->decal_clock;
+    particles = snap->particles;
+    particles_seed = snap->particles_seed;
+    particles_time = SDL_GetPerformanceCounter();                       // Restored particles move on from now
+    scene_generation++;                                                 // Everything may look different now
+}
+
+// Store snapshot to disk as raw block (same machine/build is expected to load it)
+bool snapshot_write(const Snapshot *snap, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("Snapshot: cannot create '%s'\n", path);
+        return false;
+    }
+    bool ok = fwrite(snap, sizeof(Snapshot), 1, file) == 1;
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+// Load snapshot from disk, rejects files of other format version
+bool snapshot_read(Snapshot *snap, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+
+    Snapshot loaded;
+    bool ok = fread(&loaded, sizeof(Snapshot), 1, file) == 1 && loaded.magic == SNAPSHOT_MAGIC && loaded.version == SNAPSHOT_VERSION;
+    fclose(file);
+    if (!ok) {
+        printf("Snapshot: '%s' is not a compatible snapshot\n", path);
+        return false;
+    }
+    *snap = loaded;
+    return true;
+}
+
+// Gather per-frame state shared by all views - sprite list and textures are looked up once, not once per view
+static void r_prepare_frame(SceneFrame *frame) {
+    frame->sprite_count = 0;
+    for (int i = 0; i < MAPX * MAPY; i++) {
+        if (map_sprites[i] <= 0) continue;
+        frame->sprite_cell[frame->sprite_count] = i;
+        frame->sprite_type[frame->sprite_count++] = map_sprites[i];
+    }
+    frame->ground = asset_pixels[ASSET_GROUND];
+    frame->ceiling = asset_pixels[ASSET_CEILING];
+}
+
+// Render one camera into current framebuffer and viewport
+static void r_render_view(struct Player *cam, const SceneFrame *frame) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (object_ids) {                                                   // Pixels no surface claims stay OBJECT_NONE
+        for (int y = viewport.y; y < viewport.y + viewport.height; y++) memset(object_ids + y * SCREEN_WIDTH + viewport.x, 0, viewport.width * 4);
+    }
+    if (scene_type == SCENE_TERRAIN) {
+        t_render_terrain(cam);                                          // Heightmap terrain
+    } else {
+        r_raycast(cam, frame);                                          // Dungeon map
+    }
+    metrics_add(METRIC_STAGE_SCENE_US, metrics_since(start));
+    metrics_add(METRIC_RAYS, r_ray_count());                            // Both scene types cast one ray per column
+}
+
+// Render 3D view of active scene type
+void r_render_scene(struct Player *cam) {
+    SceneFrame frame;
+    r_prepare_frame(&frame);
+    r_render_view(cam, &frame);
+}
+
+// Multi-view job state
+typedef struct {
+    const View *views;                                                  // Views of frame
+    const SceneFrame *frame;                                            // State shared by all views
+} ViewJob;
+
+// Render job - one view, its columns and tiles are split further on worker pool
+static void r_view_job(void *data, int index) {
+    ViewJob *job = data;
+    const View *view = &job->views[index];
+    pixels = view->target;
+    surfaces = view->surfaces;
+    object_ids = view->object_ids;
+    viewport = view->rect;
+    Uint64 frame_start = SDL_GetPerformanceCounter();
+    if (view->frame) r_clearscreenbuffer();
+    r_render_view(view->cam, job->frame);
+    if (view->frame) metrics_frame(frame_start);
+}
+
+// Render several cameras (split-screen, picture-in-picture, batch of agents) in one call. Per-frame state is
+// gathered once and views run side by side on worker pool, so extra view costs its rays, not whole frame
+void r_render_views(const View *views, int count) {
+    SceneFrame frame;
+    r_prepare_frame(&frame);
+    uint32_t *own_pixels = pixels;                                      // Calling thread renders views too
+    uint32_t *own_surfaces = surfaces;
+    uint32_t *own_object_ids = object_ids;
+    Viewport own_viewport = viewport;
+    ViewJob job = { views, &frame };
+    jobs_run(r_view_job, &job, count);
+    pixels = own_pixels;
+    surfaces = own_surfaces;
+    object_ids = own_object_ids;
+    viewport = own_viewport;
+}
+
+// Frame stage - clear 2D map area and draw map with player
+static void r_stage_map(void) {
+    r_clear_rect(viewport);
+    if (scene_type == SCENE_TERRAIN) {
+        t_draw_terrain_map(&view_player);                               // Draw terrain colour map with player
+    } else {
+        r_drawlevel();                                                  // Draw 2D map representation
+        r_drawplayer(view_player.cell_x * MAP_CELL_SIZE + (int)view_player.off_x, // Draw player as colored square
+                     view_player.cell_y * MAP_CELL_SIZE + (int)view_player.off_y, 0xffff0090);
+    }
+}
+
+// Frame stage - render 3D view (and picture-in-picture camera). Every pixel of view is drawn, so it needs no clearing
+static void r_stage_scene(void) {
+    View views[2] = {                                                   // Player view and optional security camera
+        { .cam = &view_player, .target = pixels, .rect = viewport,
+          .surfaces = deferred_shading && scene_type == SCENE_DUNGEON ? surface_buffer : NULL, .object_ids = object_buffer },
+        { .cam = &view_security_cam, .target = pip_pixels,
+          .rect = { SCREEN_WIDTH - PIP_SIZE - PIP_MARGIN, PIP_MARGIN, PIP_SIZE, PIP_SIZE } },
+    };
+    bool pip = pip_on && debug_view == DEBUG_VIEW_OFF;                  // Heatmaps describe player view only
+    r_render_views(views, pip ? 2 : 1);
+    if (pip) r_blit_view(&views[1], pixels);
+}
+
+// Frame stage - rays of player view over 2D map
+static void r_stage_overlay(void) {
+    if (scene_type == SCENE_DUNGEON) r_draw_rays(&view_player);
+}
+
+// Frame stage - debug heatmap and HUD over 3D view
+static void r_stage_hud(void) {
+    if (debug_view != DEBUG_VIEW_OFF) r_draw_debug_view();              // Show heatmap instead of shaded scene
+    r_draw_hud();                                                       // Lastly HUD is drawn over rendered scene
+}
+
+// Copy view rectangle from its framebuffer into frame and outline it
+void r_blit_view(const View *view, uint32_t *frame) {
+    const Viewport *rect = &view->rect;
+    for (int y = rect->y; y < rect->y + rect->height; y++) {
+        memcpy(frame + y * SCREEN_WIDTH + rect->x, view->target + y * SCREEN_WIDTH + rect->x, rect->width * 4);
+    }
+    int x0 = rect->x - 1, y0 = rect->y - 1, x1 = rect->x + rect->width, y1 = rect->y + rect->height;
+    r_drawline(x0, y0, x1, y0, 0xFF000000);                             // Border
+    r_drawline(x0, y1, x1, y1, 0xFF000000);
+    r_drawline(x0, y0, x0, y1, 0xFF000000);
+    r_drawline(x1, y0, x1, y1, 0xFF000000);
+}
+
+// Lattice value in range 0-1 for value noise (integer hash, same value for every run)
+static float t_lattice(int x, int y) {
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return (float)((h ^ (h >> 16)) & 0xFFFF) / 65535.0f;
+}
+
+// Smoothly interpolated value noise with lattice spacing period, wraps around terrain edges
+static float t_noise(int x, int y, int period) {
+    int cells = TERRAIN_SIZE / period;                                  // Lattice points per terrain side
+    int cx = x / period, cy = y / period;
+    float fx = (float)(x % period) / period, fy = (float)(y % period) / period;
+    fx = fx * fx * (3.0f - 2.0f * fx);                                  // Smoothstep between lattice points
+    fy = fy * fy * (3.0f - 2.0f * fy);
+    float v00 = t_lattice(cx, cy), v10 = t_lattice((cx + 1) % cells, cy);
+    float v01 = t_lattice(cx, (cy + 1) % cells), v11 = t_lattice((cx + 1) % cells, (cy + 1) % cells);
+    float top = v00 + (v10 - v00) * fx;
+    float bottom = v01 + (v11 - v01) * fx;
+    return top + (bottom - top) * fy;
+}
+
+// Generate heightmap (sum of noise octaves) and colour map (height bands lit from north-west)
+void t_terrain_init(void) {
+    if (terrain_ready) return;
+
+    for (int y = 0; y < TERRAIN_SIZE; y++) {
+        for (int x = 0; x < TERRAIN_SIZE; x++) {
+            float h = 0, amplitude = 0.5f;
+            for (int period = 256; period >= 4; period /= 2) {          // Octaves from hills down to bumps
+                h += t_noise(x, y, period) * amplitude;
+                amplitude *= 0.5f;
+            }
+            h = h * h * 1.6f;                                           // Flatter valleys, sharper peaks
+            if (h > 1.0f) h = 1.0f;
+            int height = (int)(h * 255);
+            terrain_height[y * TERRAIN_SIZE + x] = height < TERRAIN_WATER_LEVEL ? TERRAIN_WATER_LEVEL : height;
+        }
+    }
+
+    for (int y = 0; y < TERRAIN_SIZE; y++) {
+        for (int x = 0; x < TERRAIN_SIZE; x++) {
+            int height = terrain_height[y * TERRAIN_SIZE + x];
+            int lit = terrain_height[((y - 1) & (TERRAIN_SIZE - 1)) * TERRAIN_SIZE + ((x - 1) & (TERRAIN_SIZE - 1))];
+            uint32_t color;                                             // Base colour of height band
+            if (height <= TERRAIN_WATER_LEVEL) color = 0x2A5A8C;        // Water
+            else if (height < TERRAIN_WATER_LEVEL + 6) color = 0xC2B280; // Sand
+            else if (height < 150) color = 0x4A7A32;                    // Grass
+            else if (height < 200) color = 0x7A6A58;                    // Rock
+            else color = 0xE8E8EC;                                      // Snow
+            float light = 1.0f + (lit - height) * 0.08f;                // Slopes facing light are brighter
+            if (light < 0.5f) light = 0.5f;
+            if (light > 1.3f) light = 1.3f;
+
+            uint32_t r_comp = ((color >> 16) & 0xFF) * light;           // Red component
+            uint32_t g = ((color >> 8) & 0xFF) * light;                 // Green component
+            uint32_t b = (color & 0xFF) * light;                        // Blue component
+            if (r_comp > 255) r_comp = 255;
+            if (g > 255) g = 255;
+            if (b > 255) b = 255;
+            terrain_color[y * TERRAIN_SIZE + x] = 0xFF000000 | (r_comp << 16) | (g << 8) | b;
+        }
+    }
+    terrain_ready = true;
+}
+
+// Switch scene type, dungeon position is kept while walking around terrain
+void t_set_scene(int type) {
+    static int dungeon_cell_x, dungeon_cell_y;                          // Player position in dungeon before switch
+    static float dungeon_off_x, dungeon_off_y;
+    if (type == scene_type) return;
+
+    if (type == SCENE_TERRAIN) {
+        t_terrain_init();
+        dungeon_cell_x = player.cell_x;
+        dungeon_cell_y = player.cell_y;
+        dungeon_off_x = player.off_x;
+        dungeon_off_y = player.off_y;
+    } else {
+        player.cell_x = dungeon_cell_x;                                 // Terrain position may be inside wall
+        player.cell_y = dungeon_cell_y;
+        player.off_x = dungeon_off_x;
+        player.off_y = dungeon_off_y;
+    }
+    scene_type = type;
+    scene_generation++;
+}
+
+// Terrain render job state
+typedef struct {
+    struct Player *cam;                                                 // Camera to render
+    uint32_t *target;                                                   // Framebuffer of calling thread
+    uint32_t *object_ids;                                               // Object id buffer of calling thread
+    Viewport viewport;                                                  // Viewport of calling thread
+    float eye_z;                                                        // Camera height in world units
+} TerrainJob;
+
+// Render one strip of DEBUG_STRIP_RAYS columns. Every column marches front to back over heightmap, keeping
+// lowest drawn row (y-buffer) - only samples rising above it are drawn, column ends when it reaches screen top
+static void t_render_strip(void *data, int strip) {
+    TerrainJob *job = data;
+    struct Player *cam = job->cam;
+    pixels = job->target;                                               // Strips may run on worker threads
+    object_ids = job->object_ids;
+    viewport = job->viewport;
+
+    Uint64 strip_start = SDL_GetPerformanceCounter();
+    const int horizon = viewport.y + viewport.height / 2 + (int)cam->pitch; // Screen row of horizon (moves with pitch)
+    const float proj = (float)viewport.width;                           // Projection scale like in r_raycast()
+    int rays = r_ray_count();                                           // Rays of viewport
+    float angle_step = (float)FOV / (float)rays;                        // Angle increment between columns
+    int column_width = r_column_width();                                // Width of each rendered column
+    int strip_end = (strip + 1) * DEBUG_STRIP_RAYS < rays ? (strip + 1) * DEBUG_STRIP_RAYS : rays;
+
+    for (int r = strip * DEBUG_STRIP_RAYS; r < strip_end; r++) {
+        float rangle = cam->angle - FOV / 2.0f + r * angle_step;        // Angle of this column
+        float rayAngleRad = m_deg_to_rad(rangle);
+        float rayDirX = cos(rayAngleRad);                               // X component of ray direction
+        float rayDirY = -sin(rayAngleRad);                              // Y component of ray direction
+        float cosA = cos(m_deg_to_rad(rangle - cam->angle));            // Fisheye correction factor
+
+        int ybot = viewport.y + viewport.height;                        // Rows from ybot down are drawn already
+        int samples = 0;
+        float distance = 1.0f;
+        while (distance < TERRAIN_DRAW_DISTANCE && ybot > viewport.y) {
+            int tx = (cam->cell_x * MAP_CELL_SIZE + (int)floorf(cam->off_x + rayDirX * distance)) & (TERRAIN_SIZE - 1); // Terrain texel (wraps around)
+            int ty = (cam->cell_y * MAP_CELL_SIZE + (int)floorf(cam->off_y + rayDirY * distance)) & (TERRAIN_SIZE - 1);
+            float perpDistance = distance * cosA;
+            float height = terrain_height[ty * TERRAIN_SIZE + tx] * TERRAIN_HEIGHT_SCALE;
+            int y = horizon + (int)((job->eye_z - height) * proj / perpDistance); // Screen row of sample top
+            if (y < viewport.y) y = viewport.y;
+            samples++;
+
+            if (y < ybot) {                                             // Sample rises above drawn part of column
+                uint32_t color = terrain_color[ty * TERRAIN_SIZE + tx];
+
+                // Apply distance-based darkening like walls and floors
+                float darkening = 1.0f - (perpDistance / (MAP_CELL_SIZE * TERRAIN_DISTANCE_DIMMING));
+                if (darkening < TERRAIN_MIN_BRIGHTNESS) darkening = TERRAIN_MIN_BRIGHTNESS;
+                uint32_t r_comp = ((color >> 16) & 0xFF) * darkening;   // Red component
+                uint32_t g = ((color >> 8) & 0xFF) * darkening;         // Green component
+                uint32_t b = (color & 0xFF) * darkening;                // Blue component
+                color = 0xFF000000 | (r_comp << 16) | (g << 8) | b;     // Recombine color
+
+                uint32_t id = OBJECT_ID(OBJECT_TERRAIN, ty / TERRAIN_ID_ROWS, (ty % TERRAIN_ID_ROWS) * TERRAIN_SIZE + tx);
+                for (int row = y; row < ybot; row++) {
+                    for (int i = 0; i < column_width; i++) {
+                        r_drawpoint(r_column_x(r, column_width, i), row, color);
+                        if (object_ids) r_drawid(r_column_x(r, column_width, i), row, id);
+                    }
+                }
+                ybot = y;
+            }
+            distance += 1.0f + distance * TERRAIN_LOD_GROWTH;           // Coarser steps far away
+        }
+
+        // Sky gradient above terrain
+        for (int row = viewport.y; row < ybot; row++) {
+            float t = horizon > viewport.y ? (float)(row - viewport.y) / (horizon - viewport.y) : 1.0f; // 0 at top, 1 at horizon
+            if (t > 1.0f) t = 1.0f;
+            uint32_t color = 0xFF000000 | ((uint32_t)(0x3A + t * (0xB0 - 0x3A)) << 16) |
+                             ((uint32_t)(0x6E + t * (0xC8 - 0x6E)) << 8) | (uint32_t)(0xA5 + t * (0xE0 - 0xA5));
+            for (int i = 0; i < column_width; i++) {
+                r_drawpoint(r_column_x(r, column_width, i), row, color);
+                if (object_ids) r_drawid(r_column_x(r, column_width, i), row, OBJECT_ID(OBJECT_SKY, 0, 0));
+            }
+        }
+        if (debug_view == DEBUG_VIEW_TRAVERSAL) debug_column_cells[r] = samples;
+    }
+    if (debug_view == DEBUG_VIEW_STRIP_TIME) debug_strip_time[strip] = SDL_GetPerformanceCounter() - strip_start;
+}
+
+// Render heightmap terrain - strips of columns are independent, so they run on worker pool
+void t_render_terrain(struct Player *cam) {
+    int tx = (cam->cell_x * MAP_CELL_SIZE + (int)cam->off_x) & (TERRAIN_SIZE - 1); // Camera follows ground under player
+    int ty = (cam->cell_y * MAP_CELL_SIZE + (int)cam->off_y) & (TERRAIN_SIZE - 1);
+    TerrainJob job = {
+        .cam = cam,
+        .target = pixels,
+        .object_ids = object_ids,
+        .viewport = viewport,
+        .eye_z = terrain_height[ty * TERRAIN_SIZE + tx] * TERRAIN_HEIGHT_SCALE + TERRAIN_EYE_HEIGHT,
+    };
+    jobs_run(t_render_strip, &job, (r_ray_count() + DEBUG_STRIP_RAYS - 1) / DEBUG_STRIP_RAYS);
+    pixels = job.target;                                                // Calling thread rendered strips too
+    object_ids = job.object_ids;
+    viewport = job.viewport;
+}
+
+// Draw terrain colour map (scaled to 2D map area) with player position
+void t_draw_terrain_map(struct Player *cam) {
+    const int scale = TERRAIN_SIZE / 512;                               // Terrain texels per map pixel
+    for (int y = 0; y < 512; y++) {
+        for (int x = 0; x < 512; x++) {
+            r_drawpoint(x, y, terrain_color[(y * scale) * TERRAIN_SIZE + x * scale]);
+        }
+    }
+    int px = ((cam->cell_x * MAP_CELL_SIZE + (int)cam->off_x) & (TERRAIN_SIZE - 1)) / scale; // Player position on map
+    int py = ((cam->cell_y * MAP_CELL_SIZE + (int)cam->off_y) & (TERRAIN_SIZE - 1)) / scale;
+    r_drawplayer(px - 4, py - 4, 0xffff0090);
+    r_drawline(px, py, px + cam->dx * 12, py + cam->dy * 12, 0xffff0090); // Facing direction
+}
+
+// Random number in range -1 to 1 for particle spreads (xorshift, main thread only)
+static float p_random(void) {
+    particles_seed ^= particles_seed << 13;
+    particles_seed ^= particles_seed >> 17;
+    particles_seed ^= particles_seed << 5;
+    return (float)(particles_seed & 0xFFFF) / 32767.5f - 1.0f;
+}
+
+// Add particle at offset (x, y) from corner of map cell, dropped (and counted) when MAX_PARTICLES are alive
+void p_spawn(int cell_x, int cell_y, float x, float y, float z, float vx, float vy, float vz, float life, uint32_t color) {
+    if (particles.count >= MAX_PARTICLES) {
+        metrics_add(METRIC_PARTICLES_DROPPED, 1);
+        return;
+    }
+    int i = particles.count++;
+    m_cell_normalize(&cell_x, &x);
+    m_cell_normalize(&cell_y, &y);
+    particles.cell_x[i] = cell_x;
+    particles.cell_y[i] = cell_y;
+    particles.off_x[i] = x;
+    particles.off_y[i] = y;
+    particles.z[i] = z;
+    particles.vx[i] = vx;
+    particles.vy[i] = vy;
+    particles.vz[i] = vz;
+    particles.life[i] = life;
+    particles.fade[i] = 1.0f / life;
+    particles.color[i] = color;
+}
+
+// Move particles by time since last update (gravity, floor and ceiling bounce) and remove dead ones.
+// Returns true while particles are alive, so game loop keeps redrawing
+bool p_update(void) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    float dt = (float)(now - particles_time) / SDL_GetPerformanceFrequency();
+    particles_time = now;
+    if (particles.count == 0) return false;
+    if (dt > 0.1f) dt = 0.1f;                                           // Long stall doesn't throw particles through walls
+
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 step = _mm_set1_ps(dt), gravity = _mm_set1_ps(PARTICLE_GRAVITY * dt);
+    const __m128 floor_z = _mm_setzero_ps(), ceiling_z = _mm_set1_ps(MAP_CELL_SIZE);
+    const __m128 bounce = _mm_set1_ps(-0.4f), friction = _mm_set1_ps(0.6f);
+    for (; i < particles.count; i += 4) {                               // Arrays hold multiple of 4 entries, tail lanes are unused
+        __m128 vx = _mm_loadu_ps(particles.vx + i), vy = _mm_loadu_ps(particles.vy + i);
+        __m128 vz = _mm_sub_ps(_mm_loadu_ps(particles.vz + i), gravity);
+        __m128 z = _mm_add_ps(_mm_loadu_ps(particles.z + i), _mm_mul_ps(vz, step));
+        __m128 hit = _mm_or_ps(_mm_cmplt_ps(z, floor_z), _mm_cmpgt_ps(z, ceiling_z)); // Lanes touching floor or ceiling
+        vz = _mm_or_ps(_mm_and_ps(hit, _mm_mul_ps(vz, bounce)), _mm_andnot_ps(hit, vz));
+        vx = _mm_or_ps(_mm_and_ps(hit, _mm_mul_ps(vx, friction)), _mm_andnot_ps(hit, vx));
+        vy = _mm_or_ps(_mm_and_ps(hit, _mm_mul_ps(vy, friction)), _mm_andnot_ps(hit, vy));
+        _mm_storeu_ps(particles.off_x + i, _mm_add_ps(_mm_loadu_ps(particles.off_x + i), _mm_mul_ps(vx, step)));
+        _mm_storeu_ps(particles.off_y + i, _mm_add_ps(_mm_loadu_ps(particles.off_y + i), _mm_mul_ps(vy, step)));
+        _mm_storeu_ps(particles.z + i, _mm_min_ps(_mm_max_ps(z, floor_z), ceiling_z));
+        _mm_storeu_ps(particles.vx + i, vx);
+        _mm_storeu_ps(particles.vy + i, vy);
+        _mm_storeu_ps(particles.vz + i, vz);
+        _mm_storeu_ps(particles.life + i, _mm_sub_ps(_mm_loadu_ps(particles.life + i), step));
+    }
+#endif
+    for (; i < particles.count; i++) {                                  // Scalar version (no SSE2)
+        particles.vz[i] -= PARTICLE_GRAVITY * dt;
+        float z = particles.z[i] + particles.vz[i] * dt;
+        if (z < 0.0f || z > MAP_CELL_SIZE) {                            // Bounce off floor or ceiling
+            particles.vz[i] *= -0.4f;
+            particles.vx[i] *= 0.6f;
+            particles.vy[i] *= 0.6f;
+        }
+        particles.off_x[i] += particles.vx[i] * dt;
+        particles.off_y[i] += particles.vy[i] * dt;
+        particles.z[i] = z < 0.0f ? 0.0f : z > MAP_CELL_SIZE ? MAP_CELL_SIZE : z;
+        particles.life[i] -= dt;
+    }
+
+    // Move particles which left their cell to neighbour cell, remove particles which burned out or flew into wall
+    // (last particle takes place of removed one)
+    for (i = 0; i < particles.count; ) {
+        m_cell_normalize(&particles.cell_x[i], &particles.off_x[i]);
+        m_cell_normalize(&particles.cell_y[i], &particles.off_y[i]);
+        int cell_x = particles.cell_x[i], cell_y = particles.cell_y[i];
+        bool inside = cell_x >= 0 && cell_x < MAPX && cell_y >= 0 && cell_y < MAPY && map[cell_y * MAPX + cell_x] == 0;
+        if (particles.life[i] > 0.0f && inside) {
+            i++;
+            continue;
+        }
+        int last = --particles.count;
+        particles.cell_x[i] = particles.cell_x[last];
+        particles.cell_y[i] = particles.cell_y[last];
+        particles.off_x[i] = particles.off_x[last];
+        particles.off_y[i] = particles.off_y[last];
+        particles.z[i] = particles.z[last];
+        particles.vx[i] = particles.vx[last];
+        particles.vy[i] = particles.vy[last];
+        particles.vz[i] = particles.vz[last];
+        particles.life[i] = particles.life[last];
+        particles.fade[i] = particles.fade[last];
+        particles.color[i] = particles.color[last];
+    }
+    return true;                                                        // Last frame showed particles, redraw even when all died
+}
+
+// Point where centre ray of last frame hit wall (crosshair sits on screen centre, horizon moves with pitch), x and y
+// are offsets from corner of camera cell. Returns false when centre ray hit nothing
+bool m_crosshair_hit(struct Player *cam, float *x, float *y, float *z) {
+    if (cam->ray_count == 0) return false;                              // Not rendered yet
+    float dist = cam->rays_d[cam->ray_count / 2];                       // Centre column distance of last frame
+    if (dist >= 1000000) return false;
+    float angle = m_deg_to_rad(cam->angle);
+    *x = cam->off_x + cos(angle) * dist;
+    *y = cam->off_y - sin(angle) * dist;
+    *z = MAP_CELL_SIZE / 2.0f + cam->pitch * dist / viewport.width;
+    return true;
+}
+
+// Generate decal atlas images - bullet hole, blood splat and exit sign - and put exit sign on wall seen from start
+void d_init(void) {
+    memset(decal_atlas, 0, sizeof(decal_atlas));
+    for (int y = 0; y < 8; y++) {                                       // Bullet hole - dark core with soft rim
+        for (int x = 0; x < 8; x++) {
+            float d = sqrtf((x - 3.5f) * (x - 3.5f) + (y - 3.5f) * (y - 3.5f));
+            uint32_t a = d < 2.0f ? 255 : d < 3.5f ? (uint32_t)(255 * (3.5f - d) / 1.5f) : 0;
+            uint32_t c = 0x14 * a / 255;
+            decal_atlas[y * DECAL_ATLAS_SIZE + x] = a << 24 | c << 16 | c << 8 | c;
+        }
+    }
+    for (int y = 0; y < 16; y++) {                                      // Blood - blob with lumpy edge
+        for (int x = 0; x < 16; x++) {
+            float dx = x - 7.5f, dy = y - 7.5f;
+            float edge = 5.0f + 1.5f * sinf(atan2f(dy, dx) * 5.0f) + ((x * 7 + y * 13) % 5) * 0.2f;
+            float d = sqrtf(dx * dx + dy * dy);
+            uint32_t a = d < edge - 1.0f ? 230 : d < edge ? (uint32_t)(230 * (edge - d)) : 0;
+            decal_atlas[y * DECAL_ATLAS_SIZE + 8 + x] = a << 24 | (0x70 * a / 255) << 16;
+        }
+    }
+    for (int y = 0; y < 16; y++) {                                      // Exit sign - green plate with white arrow
+        for (int x = 0; x < 32; x++) {
+            bool border = x == 0 || x == 31 || y == 0 || y == 15;
+            bool shaft = x >= 6 && x < 20 && y >= 6 && y < 10;
+            bool head = x >= 20 && x < 27 && abs(y * 2 - 15) <= 2 * (27 - x) - 1;
+            uint32_t color = border ? 0xFF103010 : shaft || head ? 0xFFF0F0F0 : 0xFF1A7A1A;
+            decal_atlas[(16 + y) * DECAL_ATLAS_SIZE + x] = color;
+        }
+    }
+    d_add(7 * MAPX + 4, FACE_NORTH, DECAL_SIGN, 32, 20);                // South wall in front of player start
+}
+
+// Place decal centred on texel (u, v) of wall face. Face keeps DECALS_PER_FACE decals, decals covering (u, v) count
+// as used again and the least recently used one makes room
+void d_add(int cell, int face, int type, int u, int v) {
+    int index = cell * 4 + face;
+    for (int k = 0; k < decal_count[index]; k++) {                      // Refresh decals which were hit
+        Decal *decal = &decal_faces[index][k];
+        const DecalRect *rect = &decal_rects[decal->type];
+        if (u >= decal->u && u < decal->u + rect->w && v >= decal->v && v < decal->v + rect->h) decal->stamp = ++decal_clock;
+    }
+
+    Decal *slot;
+    if (decal_count[index] < DECALS_PER_FACE) {
+        slot = &decal_faces[index][decal_count[index]++];
+    } else {
+        slot = &decal_faces[index][0];                                  // Evict least recently used decal
+        for (int k = 1; k < DECALS_PER_FACE; k++) {
+            if (decal_faces[index][k].stamp < slot->stamp) slot = &decal_faces[index][k];
+        }
+    }
+    *slot = (Decal){ (short)(u - decal_rects[type].w / 2), (short)(v - decal_rects[type].h / 2), (uint8_t)type, ++decal_clock };
+    scene_generation++;
+}
+
+// Bullet hole (or blood of hit target) on wall face where centre ray of last frame ended
+void d_shoot(struct Player *cam, bool blood) {
+    float x, y, z;
+    if (scene_type == SCENE_TERRAIN || cam->hit_face < 0 || !m_crosshair_hit(cam, &x, &y, &z)) return;
+
+    // Face and texture column come from r_raycast(), v counts down from top of wall like wall texture rows
+    int cell = cam->hit_face / 4;
+    float top = map_heights[cell] * MAP_CELL_SIZE;
+    d_add(cell, cam->hit_face % 4, blood ? DECAL_BLOOD : DECAL_BULLET_HOLE, cam->hit_u, (int)((top - z) * TEXTURE_SIZE / MAP_CELL_SIZE));
+}
+
+// Shot along view direction - muzzle flash in front of camera, sparks and smoke where centre ray hit wall
+void p_fire(struct Player *cam) {
+    float angle = m_deg_to_rad(cam->angle);
+    float dir_x = cos(angle), dir_y = -sin(angle);
+    float eye = MAP_CELL_SIZE / 2.0f;
+
+    // Everything spawns relative to camera cell, p_spawn() moves particles to cells they are in
+    for (int i = 0; i < 8; i++) {                                       // Short additive flash
+        p_spawn(cam->cell_x, cam->cell_y, cam->off_x + dir_x * 12, cam->off_y + dir_y * 12, eye - 6, dir_x * 40 + p_random() * 20, dir_y * 40 + p_random() * 20,
+                p_random() * 20 + PARTICLE_GRAVITY * 0.05f, 0.06f, 0x00FFD060);
+    }
+
+    float hit_x, hit_y, hit_z;
+    if (!m_crosshair_hit(cam, &hit_x, &hit_y, &hit_z)) return;         // Shot flies into void
+    hit_x -= dir_x;                                                     // Just in front of wall
+    hit_y -= dir_y;
+    for (int i = 0; i < IMPACT_SPARKS; i++) {                           // Sparks jump back towards shooter
+        float speed = 60 + 60 * p_random();
+        p_spawn(cam->cell_x, cam->cell_y, hit_x, hit_y, hit_z, (-dir_x + p_random() * 0.8f) * speed, (-dir_y + p_random() * 0.8f) * speed,
+                (0.5f + p_random() * 0.8f) * speed, 0.35f + 0.15f * p_random(), 0x00FFB040);
+    }
+    for (int i = 0; i < IMPACT_SMOKE; i++) {                            // Smoke drifts up slowly (gravity is cancelled by upward push)
+        p_spawn(cam->cell_x, cam->cell_y, hit_x - dir_x * 2, hit_y - dir_y * 2, hit_z, -dir_x * 8 + p_random() * 6, -dir_y * 8 + p_random() * 6,
+                PARTICLE_GRAVITY * 0.9f + p_random() * 5, 0.9f + 0.3f * p_random(), 0x60404040);
+    }
+}
+
+// Draw particles as small square billboards. Visible particles are binned by screen column first, then drawn column
+// after column, depth tested against wall distances and occluders of their column like sprites
+void p_render(struct Player *cam, const float *wall_distances, const ColumnOcclusion *occlusion, int column_width) {
+    if (particles.count == 0) return;
+
+    const int rays = r_ray_count();
+    const float proj = (float)viewport.width;                           // Same projection as r_raycast()
+    const float eye = MAP_CELL_SIZE / 2.0f;
+    const int horizon = viewport.y + viewport.height / 2 + (int)cam->pitch;
+    const int vp_bottom = viewport.y + viewport.height;
+    const float vp_right = (float)(viewport.x + viewport.width);
+    const float angle = m_deg_to_rad(cam->angle);
+    const float dir_x = cos(angle), dir_y = -sin(angle);
+
+    // Project particles within budget
+    int count = particles.count < PARTICLE_DRAW_BUDGET ? particles.count : PARTICLE_DRAW_BUDGET;
+    int culled = 0;
+    short px[PARTICLE_DRAW_BUDGET], py[PARTICLE_DRAW_BUDGET], size[PARTICLE_DRAW_BUDGET], column[PARTICLE_DRAW_BUDGET];
+    float depth[PARTICLE_DRAW_BUDGET];
+    int index[PARTICLE_DRAW_BUDGET];
+    int projected = 0;
+    int bin_count[RAY_COUNT + 1] = {0};                                 // Particles per column, then start of column bin
+    for (int i = 0; i < count; i++) {
+        float dx = (particles.cell_x[i] - cam->cell_x) * MAP_CELL_SIZE + particles.off_x[i] - cam->off_x; // Relative to camera cell
+        float dy = (particles.cell_y[i] - cam->cell_y) * MAP_CELL_SIZE + particles.off_y[i] - cam->off_y;
+        float perp = dx * dir_x + dy * dir_y;                           // Distance along view direction (no fisheye)
+        if (perp < 1.0f || (view_distance > 0 && perp >= view_distance)) { // Behind camera or hidden in fog
+            culled++;
+            continue;
+        }
+        float angle_diff = m_fix_ang(atan2f(-dy, dx) * 180.0f / PI) - cam->angle; // Columns are spaced by angle, like rays
+        if (angle_diff < -180) angle_diff += 360;
+        if (angle_diff > 180) angle_diff -= 360;
+        int r = (int)floorf((angle_diff + FOV * 0.5f) / ((float)FOV / rays));
+        if (r < 0 || r >= rays) {                                       // Outside field of view
+            culled++;
+            continue;
+        }
+        int s = (int)(PARTICLE_SIZE * proj / perp);
+        px[projected] = (short)(vp_right - (r + 0.5f) * column_width);
+        py[projected] = (short)(horizon + (eye - particles.z[i]) * proj / perp);
+        size[projected] = (short)(s < 1 ? 1 : s > PARTICLE_MAX_PIXELS ? PARTICLE_MAX_PIXELS : s);
+        column[projected] = (short)r;
+        depth[projected] = perp;
+        index[projected++] = i;
+        bin_count[r + 1]++;
+    }
+    for (int r = 0; r < rays; r++) bin_count[r + 1] += bin_count[r];    // Prefix sum - bin of column r starts at bin_count[r]
+    int bins[PARTICLE_DRAW_BUDGET];
+    int fill[RAY_COUNT];
+    memcpy(fill, bin_count, rays * sizeof(int));
+    for (int k = 0; k < projected; k++) bins[fill[column[k]]++] = k;
+
+    // Draw column bins
+    int drawn = 0;
+    for (int r = 0; r < rays; r++) {
+        const ColumnOcclusion *occ = &occlusion[r];
+        for (int b = bin_count[r]; b < bin_count[r + 1]; b++) {
+            int k = bins[b];
+            int clip_y = vp_bottom;                                     // First row covered by nearer geometry
+            if (depth[k] > wall_distances[r]) {
+                clip_y = occ->count > 0 ? occ->clip[0] : vp_bottom;
+                for (int w = 1; w < occ->count && occ->dist[w] < depth[k]; w++) clip_y = occ->clip[w];
+            }
+            int x0 = px[k] - size[k] / 2, y0 = py[k] - size[k] / 2;
+            int x1 = x0 + size[k], y1 = y0 + size[k];
+            if (x0 < viewport.x) x0 = viewport.x;
+            if (x1 > viewport.x + viewport.width) x1 = viewport.x + viewport.width;
+            if (y0 < viewport.y) y0 = viewport.y;
+            if (y1 > clip_y) y1 = clip_y;
+            if (x0 >= x1 || y0 >= y1) {
+                culled++;
+                continue;
+            }
+
+            // Fade premultiplied colour with remaining life, then src + dst * (1 - alpha)
+            int i = index[k];
+            int f = (int)(particles.life[i] * particles.fade[i] * 256);
+            if (f > 256) f = 256;
+            uint32_t c = particles.color[i];
+            uint32_t a = ((c >> 24) * f) >> 8;
+            uint32_t src[3] = { (((c >> 16) & 0xFF) * f) >> 8, (((c >> 8) & 0xFF) * f) >> 8, ((c & 0xFF) * f) >> 8 };
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    uint32_t d = pixels[y * SCREEN_WIDTH + x], out = 0xFF000000;
+                    for (int ch = 0; ch < 3; ch++) {
+                        uint32_t v = src[ch] + (((d >> (16 - ch * 8)) & 0xFF) * (255 - a)) / 255;
+                        out |= (v > 255 ? 255 : v) << (16 - ch * 8);
+                    }
+                    pixels[y * SCREEN_WIDTH + x] = out;
+                    if (debug_view == DEBUG_VIEW_OVERDRAW) debug_overdraw[y * SCREEN_WIDTH + x]++;
+                }
+            }
+            drawn++;
+        }
+    }
+    metrics_add(METRIC_PARTICLES_DRAWN, drawn);
+    metrics_add(METRIC_PARTICLES_CULLED, culled);
+    metrics_add(METRIC_PARTICLES_OVER_BUDGET, particles.count - count);
+}
+
+// Was map cell seen in last frame rendered with this visibility output
+bool vis_cell_visible(const Visibility *vis, int x, int y) {
+    if (x < 0 || x >= MAPX || y < 0 || y >= MAPY) return false;
+    int cell = y * MAPX + x;
+    return (vis->cells[cell >> 5] >> (cell & 31)) & 1;
+}
+
+// Was sprite in map cell seen in last frame (at least one column of it passed depth test)
+bool vis_sprite_visible(const Visibility *vis, int x, int y) {
+    for (int i = 0; i < vis->sprite_count; i++) {
+        if (vis->sprites[i] == y * MAPX + x) return true;
+    }
+    return false;
+}
+
+// Object id of pixel in last frame of player view (OBJECT_NONE outside 3D view). Called from main thread, whose
+// viewport is player view
+uint32_t vis_pick(int x, int y) {
+    if (x < viewport.x || x >= viewport.x + viewport.width || y < viewport.y || y >= viewport.y + viewport.height) {
+        return OBJECT_ID(OBJECT_NONE, 0, 0);
+    }
+    return object_buffer[y * SCREEN_WIDTH + x];
+}
+
+// Print object id in readable form - class, type and map cell (terrain texel)
+void vis_print_object(uint32_t id) {
+    int cls = id >> 28, type = (id >> 20) & 0xFF, instance = id & OBJECT_NO_INSTANCE;
+    if (cls >= OBJECT_CLASS_COUNT) cls = OBJECT_NONE;
+    if (cls == OBJECT_NONE || cls == OBJECT_SKY || instance == OBJECT_NO_INSTANCE) {
+        printf("Aimed at: %s\n", object_class_names[cls]);
+    } else if (cls == OBJECT_TERRAIN) {
+        printf("Aimed at: %s (%d, %d)\n", object_class_names[cls], instance % TERRAIN_SIZE,
+               type * TERRAIN_ID_ROWS + instance / TERRAIN_SIZE);     // Row above TERRAIN_ID_ROWS continues in type
+    } else {
+        printf("Aimed at: %s type %d in cell (%d, %d)\n", object_class_names[cls], type, instance % MAPX, instance / MAPX);
+    }
+}
+
+// Add to runtime metric counter (cheap atomic add, safe from any render thread)
+void metrics_add(int metric, int value) {
+    SDL_AtomicAdd(&metric_pending[metric], value);
+}
+
+// Microseconds since performance counter value
+Uint64 metrics_since(Uint64 start) {
+    return (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+// Count finished frame which started at performance counter value into frame time histogram
+void metrics_frame(Uint64 start) {
+    Uint64 us = metrics_since(start);
+    int bucket = 0;
+    while (bucket < METRICS_FRAME_BUCKETS && us > metrics_bucket_ms[bucket] * 1000) bucket++;
+    if (bucket < METRICS_FRAME_BUCKETS) metrics_add(METRIC_FRAME_BUCKET + bucket, 1); // Slower frames only go to +Inf
+    metrics_add(METRIC_FRAMES, 1);
+    metrics_add(METRIC_FRAME_US, (int)us);
+}
+
+#ifdef __linux__
+// Move pending counts to 64-bit totals
+static void metrics_drain(void) {
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        metric_total[i] += (uint32_t)SDL_AtomicSet(&metric_pending[i], 0);
+    }
+}
+
+// Append formatted text to metrics page
+static void metrics_printf(char *page, size_t size, size_t *length, const char *format, ...) {
+    if (*length >= size) return;
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(page + *length, size - *length, format, args);
+    va_end(args);
+    if (written > 0) *length += written;
+}
+
+// Format all metrics in Prometheus text exposition format
+static size_t metrics_format(char *page, size_t size) {
+    size_t n = 0;
+    metrics_printf(page, size, &n, "# HELP raycast_frames_total Rendered frames.\n# TYPE raycast_frames_total counter\n");
+    metrics_printf(page, size, &n, "raycast_frames_total %llu\n", (unsigned long long)metric_total[METRIC_FRAMES]);
+
+    metrics_printf(page, size, &n, "# HELP raycast_frame_cache_requests_total Game loop frames by result, hit = nothing changed and last frame was shown again.\n");
+    metrics_printf(page, size, &n, "# TYPE raycast_frame_cache_requests_total counter\n");
+    metrics_printf(page, size, &n, "raycast_frame_cache_requests_total{result=\"hit\"} %llu\n", (unsigned long long)metric_total[METRIC_FRAMES_REUSED]);
+    metrics_printf(page, size, &n, "raycast_frame_cache_requests_total{result=\"miss\"} %llu\n", (unsigned long long)metric_total[METRIC_FRAMES_RENDERED]);
+
+    metrics_printf(page, size, &n, "# HELP raycast_frame_seconds Frame render time.\n# TYPE raycast_frame_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_FRAME_BUCKETS; i++) {
+        cumulative += metric_total[METRIC_FRAME_BUCKET + i];
+        metrics_printf(page, size, &n, "raycast_frame_seconds_bucket{le=\"%g\"} %llu\n", metrics_bucket_ms[i] / 1000, (unsigned long long)cumulative);
+    }
+    metrics_printf(page, size, &n, "raycast_frame_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)metric_total[METRIC_FRAMES]);
+    metrics_printf(page, size, &n, "raycast_frame_seconds_sum %.6f\n", metric_total[METRIC_FRAME_US] / 1e6);
+    metrics_printf(page, size, &n, "raycast_frame_seconds_count %llu\n", (unsigned long long)metric_total[METRIC_FRAMES]);
+
+    static const char *stages[] = { "map", "scene", "hud", "upload", "overlay" }; // Same order as METRIC_STAGE_* ids
+    metrics_printf(page, size, &n, "# HELP raycast_stage_seconds_total Time spent in frame stages.\n# TYPE raycast_stage_seconds_total counter\n");
+    for (int i = 0; i < 5; i++) {
+        metrics_printf(page, size, &n, "raycast_stage_seconds_total{stage=\"%s\"} %.6f\n", stages[i], metric_total[METRIC_STAGE_MAP_US + i] / 1e6);
+    }
+    metrics_printf(page, size, &n, "# HELP raycast_critical_path_seconds_total Longest chain of dependent frame stages (frame time with enough cores).\n");
+    metrics_printf(page, size, &n, "# TYPE raycast_critical_path_seconds_total counter\n");
+    metrics_printf(page, size, &n, "raycast_critical_path_seconds_total %.6f\n", metric_total[METRIC_CRITICAL_PATH_US] / 1e6);
+
+    metrics_printf(page, size, &n, "# HELP raycast_rays_total Rays cast (one per screen column).\n# TYPE raycast_rays_total counter\n");
+    metrics_printf(page, size, &n, "raycast_rays_total %llu\n", (unsigned long long)metric_total[METRIC_RAYS]);
+    metrics_printf(page, size, &n, "# HELP raycast_sprites_drawn_total Sprites drawn with at least one visible column.\n# TYPE raycast_sprites_drawn_total counter\n");
+    metrics_printf(page, size, &n, "raycast_sprites_drawn_total %llu\n", (unsigned long long)metric_total[METRIC_SPRITES]);
+    metrics_printf(page, size, &n, "# HELP raycast_particles_total Particles by what happened to them in frame or at spawn.\n# TYPE raycast_particles_total counter\n");
+    static const char *particle_results[] = { "drawn", "culled", "over_budget", "dropped" }; // Same order as METRIC_PARTICLES_* ids
+    for (int i = 0; i < 4; i++) {
+        metrics_printf(page, size, &n, "raycast_particles_total{result=\"%s\"} %llu\n", particle_results[i],
+                       (unsigned long long)metric_total[METRIC_PARTICLES_DRAWN + i]);
+    }
+
+    // Memory usage of whole process
+    long pages_total = 0, pages_resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages_total, &pages_resident) != 2) pages_total = pages_resident = 0;
+        fclose(statm);
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    metrics_printf(page, size, &n, "# HELP process_resident_memory_bytes Resident memory size in bytes.\n# TYPE process_resident_memory_bytes gauge\n");
+    metrics_printf(page, size, &n, "process_resident_memory_bytes %ld\n", pages_resident * page_size);
+    metrics_printf(page, size, &n, "# HELP process_virtual_memory_bytes Virtual memory size in bytes.\n# TYPE process_virtual_memory_bytes gauge\n");
+    metrics_printf(page, size, &n, "process_virtual_memory_bytes %ld\n", pages_total * page_size);
+    return n < size ? n : size;
+}
+
+// Metrics thread - drains counters and answers every connection with metrics page (any HTTP request path)
+static int metrics_loop(void *data) {
+    int listen_fd = (int)(intptr_t)data;
+    static char page[8192];                                             // Response body
+    static char response[8192 + 256];                                   // Header and body
+
+    while (SDL_AtomicGet(&metrics_on)) {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, METRICS_DRAIN_MS);
+        metrics_drain();
+        if (ready <= 0) continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        // Read request (content doesn't matter), slow client may not block metrics thread for long
+        struct pollfd cfd = { .fd = fd, .events = POLLIN };
+        char request[1024];
+        if (poll(&cfd, 1, 1000) > 0 && read(fd, request, sizeof(request)) > 0) {
+            size_t length = metrics_format(page, sizeof(page));
+            int header = snprintf(response, sizeof(response),
+                                  "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", length);
+            memcpy(response + header, page, length);
+            send(fd, response, header + length, MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+    close(listen_fd);
+    return 0;
+}
+
+// Serve metrics over HTTP on Unix socket path, or on loopback TCP port when endpoint is number
+bool metrics_start(const char *endpoint) {
+    char *end;
+    long port = strtol(endpoint, &end, 10);
+    int listen_fd;
+    if (*end == '\0' && port > 0 && port < 65536) {                     // Loopback TCP port
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (listen_fd >= 0) setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+            printf("Metrics: cannot listen on 127.0.0.1:%ld\n", port);
+            if (listen_fd >= 0) close(listen_fd);
+            return false;
+        }
+    } else {                                                            // Unix socket path
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(endpoint) >= sizeof(addr.sun_path)) {
+            printf("Metrics: socket path too long\n");
+            return false;
+        }
+        strcpy(addr.sun_path, endpoint);
+        unlink(endpoint);                                               // Remove stale socket of previous run
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+            printf("Metrics: cannot listen on '%s'\n", endpoint);
+            if (listen_fd >= 0) close(listen_fd);
+            return false;
+        }
+    }
+
+    SDL_AtomicSet(&metrics_on, 1);
+    metrics_thread = SDL_CreateThread(metrics_loop, "metrics", (void *)(intptr_t)listen_fd);
+    if (!metrics_thread) {
+        close(listen_fd);
+        return false;
+    }
+    return true;
+}
+
+// Stop metrics endpoint
+void metrics_stop(void) {
+    if (!metrics_thread) return;
+    SDL_AtomicSet(&metrics_on, 0);
+    SDL_WaitThread(metrics_thread, NULL);
+    metrics_thread = NULL;
+}
+#else
+bool metrics_start(const char *endpoint) {
+    (void)endpoint;
+    printf("Metrics: metrics endpoint is available only on Linux\n");
+    return false;
+}
+
+void metrics_stop(void) {
+}
+#endif
@@ -6,6 +6,7 @@
 
 #include <stdio.h>      // Standard I/O functions (printf, fopen, etc.)
 #include <stdlib.h>     // Standard library functions (malloc, exit, etc.)
+#include <stdint.h>     // Fixed-width integer types (uint32_t, uint64_t)
 #include <string.h>     // String manipulation functions (strcpy, strlen, etc.)
 #include <ctype.h>      // Character classification functions (isalnum, isdigit, etc.)
 #include <libgen.h>     // Path manipulation functions (basename)
@@ -13,21 +14,42 @@
 
 #ifdef _WIN32
     #include <io.h>
+    #include <direct.h>
     #define ftruncate _chsize
+    #define mkdir(path, mode) _mkdir(path)
 #else
     #include <unistd.h>
+    #include <pthread.h>
 #endif
 
+// Bump when generated array format changes, so cached outputs of older converter are not reused
+#define CONVERTER_VERSION "2"
+
+// Maximum number of worker threads in batch mode
+#define MAX_WORKERS 16
+
+// Colour key of transparent pixels in source images (magenta)
+#define TRANSPARENT_KEY 0xFF00FF
+
+// Soften sprite edges - opaque pixels next to transparent ones get alpha by share of opaque pixels around them (-f option)
+int feather_edges = 0;
+
 // Function to display usage instructions to the user
 void usage(const char* prog_name) {
     printf("This is simple converter from gimp exported .ppm files to ARGB uint32 array header file\n\n");
-    printf("Usage: %s <input_rgb_file> <output_header_file> [array_name]\n", prog_name);
+    printf("Usage: %s [-f] <input_rgb_file> <output_header_file> [array_name]\n", prog_name);
+    printf("       %s [-f] -c <cache_dir> <output_header_file> <input_rgb_file>...\n", prog_name);
     printf("  input_rgb_file:       ASCII file with RGB values (one value per line)\n");
     printf("  output_header_file:   output .h file to generate\n");
     printf("  array_name:           Optional custom array name (default: derived from input filename)\n");
+    printf("  -c cache_dir:         Batch mode - build whole header from all inputs, converting only changed ones\n");
+    printf("  -f:                   Feather edges of transparent (magenta) areas with partial alpha\n");
     printf("\n");
-    printf("Note: If output file exists, new array will be appended to it.\n\n");
+    printf("Note: Magenta pixels become transparent (alpha 0), colours are stored premultiplied by alpha.\n");
+    printf("Note: If output file exists, new array will be appended to it.\n");
+    printf("      In batch mode output file is rewritten, but only when its content changes.\n\n");
     printf("Example: %s texture.ppm texture.h my_texture_data\n", prog_name);
+    printf("         %s -c .asset_cache textures.h ground.ppm ceiling.ppm mossy.ppm\n", prog_name);
 }
 
 // Check if file exists
@@ -136,8 +158,8 @@ void generate_header_guard(const char* array_name, char* guard_name) {
     }
 }
 
-// Check if file starts with P3 format and skip header if so
-int skip_p3_header_if_present(FILE* file) {
+// Check if file starts with P3 format and skip header if so, image width from header is stored to width (when not NULL)
+int skip_p3_header_if_present(FILE* file, int* width) {
     char first_line[32];
     
     // Read the first line to check for P3 format
@@ -153,10 +175,14 @@ int skip_p3_header_if_present(FILE* file) {
     if (strncmp(trimmed, "P3", 2) == 0) {
         // This is P3 format, skip the next 3 lines (total 4 lines including P3)
         char line[256];
+        int w, h;
         for (int i = 0; i < 3; i++) {                                      // Skip 3 more lines
             if (fgets(line, sizeof(line), file) == NULL) {
                 break;                                                     // If can't read more lines, stop
             }
+            if (width && line[0] != '#' && sscanf(line, "%d %d", &w, &h) == 2) {
+                *width = w;                                                // Size line (comment and max value are not)
+            }
         }
         return 1;                                                          // P3 header was skipped
     } else {
@@ -173,7 +199,7 @@ int count_rgb_values(FILE* file) {
     char line[32];                                                         // Buffer for reading each line
     
     // Skip P3 header if present
-    int skipped_p3 = skip_p3_header_if_present(file);
+    int skipped_p3 = skip_p3_header_if_present(file, NULL);
     
     // Read through file line by line
     while (fgets(line, sizeof(line), file)) {
@@ -192,8 +218,378 @@ int count_rgb_values(FILE* file) {
     return count;                                                          // Return total count of RGB values
 }
 
+// Alpha of every pixel - 0 for colour key, 255 for others, or share of opaque pixels in 3x3 neighbourhood when feathering
+void compute_alpha(const uint32_t* rgb, uint8_t* alpha, int num_pixels, int width) {
+    for (int i = 0; i < num_pixels; i++) {
+        alpha[i] = rgb[i] == TRANSPARENT_KEY ? 0 : 255;
+    }
+    if (!feather_edges) return;
+    if (width <= 0 || num_pixels % width != 0) {
+        printf("Warning: Image width unknown (no P3 header), edges are not feathered\n");
+        return;
+    }
+
+    int height = num_pixels / width;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (rgb[y * width + x] == TRANSPARENT_KEY) continue;           // Transparent pixels stay transparent
+            int opaque = 0, total = 0;                                     // Neighbours inside image
+            for (int ny = y - 1; ny <= y + 1; ny++) {
+                for (int nx = x - 1; nx <= x + 1; nx++) {
+                    if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                    total++;
+                    opaque += rgb[ny * width + nx] != TRANSPARENT_KEY;
+                }
+            }
+            alpha[y * width + x] = (uint8_t)(255 * opaque / total);
+        }
+    }
+}
+
+// Convert RGB values from input file to premultiplied ARGB array definition written to output file
+void write_array(FILE* infile, FILE* outfile, const char* array_name, int num_pixels) {
+    // Write array definition
+    fprintf(outfile, "// Contains %d pixels in premultiplied ARGB format (0xAARRGGBB, magenta = transparent)\n\n", num_pixels);
+    fprintf(outfile, "static uint32_t %s[%d] = {\n", array_name, num_pixels);  // Array declaration
+    
+    // Skip P3 header if present before processing data
+    int width = 0;                                                         // Image width (0 = unknown)
+    skip_p3_header_if_present(infile, &width);
+
+    // Whole image is read first, alpha of pixel depends on its neighbours
+    uint32_t* rgb = malloc(num_pixels * sizeof(uint32_t));
+    uint8_t* alpha = malloc(num_pixels);
+    if (!rgb || !alpha) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    
+    // Process RGB values and pack them to RGB pixels
+    int pixel_count = 0;                                                   // Counter for completed pixels
+    int value_count = 0;                                                   // Counter for individual RGB values
+    int r = 0, g = 0, b = 0;                                               // Storage for red, green, blue components
+    char line[32];                                                         // Buffer for reading each line
+    
+    // Read and process each line of RGB data
+    while (fgets(line, sizeof(line), infile) && pixel_count < num_pixels) {
+        // Skip empty lines and whitespace-only lines
+        char* trimmed = line;
+        while (isspace(*trimmed)) trimmed++;
+        if (*trimmed == '\0') continue;
+        
+        int value;                                                         // Current RGB component value
+        if (sscanf(trimmed, "%d", &value) != 1) {                          // Parse integer from line
+            printf("Warning: Invalid RGB value '%s', skipping\n", trimmed);
+            continue;                                                      // Skip invalid lines
+        }
+        
+        // Validate RGB value range (0-255)
+        if (value > 255 || value < 0) {
+            printf("Warning: RGB value '%d' out of range (0-255)\n", value);
+        }
+        
+        // Clamp value to valid range
+        if (value > 255) value = 255;
+        if (value < 0) value = 0;
+        
+        // Assign value to appropriate RGB component based on position
+        switch (value_count % 3) {
+            case 0: r = value; break;                                      // First value is red
+            case 1: g = value; break;                                      // Second value is green
+            case 2:                                                        // Third value is blue - complete pixel
+                b = value;
+                rgb[pixel_count++] = (r << 16) | (g << 8) | b;            // Store pixel, increment completed pixel counter
+                break;
+        }
+        
+        value_count++;                                                    // Increment total value counter
+    }
+    while (pixel_count < num_pixels) rgb[pixel_count++] = 0;              // Invalid lines were skipped
+
+    compute_alpha(rgb, alpha, num_pixels, width);
+    for (int i = 0; i < num_pixels; i++) {
+        r = (rgb[i] >> 16) & 0xFF;
+        g = (rgb[i] >> 8) & 0xFF;
+        b = rgb[i] & 0xFF;
+
+        // Calculate ARGB value: colour premultiplied by alpha (rounded), so transparent pixels are 0
+        uint32_t a = alpha[i];
+        uint32_t argb_val = (a << 24) | ((r * a + 127) / 255 << 16) | ((g * a + 127) / 255 << 8) | (b * a + 127) / 255;
+
+        // Write pixel to output file with proper formatting, comment keeps source colour
+        fprintf(outfile, "    0x%08X%s // px%d: RGB(%d,%d,%d)\n", argb_val, i == num_pixels - 1 ? " " : ",", i, r, g, b);
+    }
+    free(rgb);
+    free(alpha);
+    
+    // Write C header file footer section
+    fprintf(outfile, "};\n\n");                                           // Close array definition
+    fprintf(outfile, "#define %s_SIZE %d\n\n", array_name, num_pixels);   // Define array size macro
+}
+
+// Batch mode entry - one input image and its cached conversion
+typedef struct {
+    const char* input_file;                                                // Source image path
+    char array_name[256];                                                  // Array name derived from input filename
+    char cache_file[1024];                                                 // Cached array definition for this input
+    int cached;                                                            // 1 = cache hit, conversion skipped
+    int failed;                                                            // 1 = input could not be converted
+} BatchEntry;
+
+// Shared work queue for batch worker threads
+typedef struct {
+    BatchEntry* entries;                                                   // All batch entries
+    int count;                                                             // Number of entries
+    int next;                                                              // Next entry to process
+#ifndef _WIN32
+    pthread_mutex_t lock;                                                  // Protects next
+#endif
+} BatchQueue;
+
+// FNV-1a 64-bit hash, continue hashing from previous value h
+uint64_t hash_bytes(uint64_t h, const void* data, size_t len) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= bytes[i];                                                     // Mix in next byte
+        h *= 0x100000001B3ULL;                                             // FNV 64-bit prime
+    }
+    return h;
+}
+
+// Hash input file content together with converter options that affect output
+int hash_input(const char* input_file, const char* array_name, uint64_t* hash) {
+    FILE* file = fopen(input_file, "rb");
+    if (!file) return 0;
+
+    uint64_t h = 0xCBF29CE484222325ULL;                                    // FNV 64-bit offset basis
+    h = hash_bytes(h, CONVERTER_VERSION, sizeof(CONVERTER_VERSION));       // Output format version
+    h = hash_bytes(h, &feather_edges, sizeof(feather_edges));              // Feathering changes alpha
+    h = hash_bytes(h, array_name, strlen(array_name) + 1);                 // Array name is part of output
+
+    char buffer[65536];
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {    // Hash whole file content
+        h = hash_bytes(h, buffer, bytes_read);
+    }
+    fclose(file);
+
+    *hash = h;
+    return 1;
+}
+
+// Convert one batch entry into its cache file (written to temporary file first, so cache never holds partial output)
+void convert_entry(BatchEntry* entry) {
+    FILE* infile = fopen(entry->input_file, "r");
+    if (!infile) {
+        fprintf(stderr, "Error: Input file '%s' not found\n", entry->input_file);
+        entry->failed = 1;
+        return;
+    }
+
+    // Same validation as in single file mode
+    int total_values = count_rgb_values(infile);
+    int num_pixels = total_values / 3;
+    if (total_values % 3 != 0 || num_pixels == 0) {
+        fprintf(stderr, "Error: '%s' doesn't contain complete RGB triplets\n", entry->input_file);
+        fclose(infile);
+        entry->failed = 1;
+        return;
+    }
+
+    char temp_file[1040];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", entry->cache_file);
+    FILE* outfile = fopen(temp_file, "w");
+    if (!outfile) {
+        fprintf(stderr, "Error: Cannot create cache file '%s'\n", temp_file);
+        fclose(infile);
+        entry->failed = 1;
+        return;
+    }
+
+    write_array(infile, outfile, entry->array_name, num_pixels);
+    fclose(infile);
+    fclose(outfile);
+
+    remove(entry->cache_file);                                             // Windows rename() doesn't overwrite
+    if (rename(temp_file, entry->cache_file) != 0) {
+        fprintf(stderr, "Error: Cannot store cache file '%s'\n", entry->cache_file);
+        entry->failed = 1;
+    }
+}
+
+// Batch worker - takes entries from shared queue until all are done
+void* batch_worker(void* data) {
+    BatchQueue* queue = data;
+    while (1) {
+#ifndef _WIN32
+        pthread_mutex_lock(&queue->lock);
+#endif
+        int index = queue->next++;                                         // Claim next entry
+#ifndef _WIN32
+        pthread_mutex_unlock(&queue->lock);
+#endif
+        if (index >= queue->count) break;                                  // No work left
+
+        BatchEntry* entry = &queue->entries[index];
+        if (!entry->cached && !entry->failed) convert_entry(entry);
+    }
+    return NULL;
+}
+
+// Compare two files byte by byte, returns 1 when both exist and are identical
+int files_equal(const char* file_a, const char* file_b) {
+    FILE* a = fopen(file_a, "rb");
+    FILE* b = fopen(file_b, "rb");
+    int equal = (a && b);
+    while (equal) {
+        int ca = fgetc(a), cb = fgetc(b);
+        if (ca != cb) equal = 0;                                           // Content differs
+        if (ca == EOF || cb == EOF) break;                                 // Reached end of (at least) one file
+    }
+    if (a) fclose(a);
+    if (b) fclose(b);
+    return equal;
+}
+
+// Batch mode - build header from all inputs, converting only inputs whose content hash is not in cache
+int run_batch(const char* cache_dir, const char* output_file, char** inputs, int count) {
+    mkdir(cache_dir, 0755);                                                // Create cache directory (may already exist)
+
+    // Input listed twice would be converted by two workers into same cache file - keep first occurrence only
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        int seen = 0;
+        for (int j = 0; j < unique && !seen; j++) seen = strcmp(inputs[j], inputs[i]) == 0;
+        if (seen) printf("Warning: Input '%s' listed more than once, skipping\n", inputs[i]);
+        else inputs[unique++] = inputs[i];
+    }
+    count = unique;
+
+    BatchEntry* entries = calloc(count, sizeof(BatchEntry));
+    if (!entries) return 1;
+
+    // Hash inputs and check which of them are already converted
+    int cached = 0;
+    for (int i = 0; i < count; i++) {
+        BatchEntry* entry = &entries[i];
+        entry->input_file = inputs[i];
+        generate_array_name(inputs[i], entry->array_name);
+
+        uint64_t hash;
+        if (!hash_input(inputs[i], entry->array_name, &hash)) {
+            fprintf(stderr, "Error: Input file '%s' not found\n", inputs[i]);
+            entry->failed = 1;
+            continue;
+        }
+        snprintf(entry->cache_file, sizeof(entry->cache_file), "%s/%016llx.h", cache_dir, (unsigned long long)hash);
+        entry->cached = file_exists(entry->cache_file);
+        cached += entry->cached;
+    }
+
+    // Convert changed inputs in parallel
+    BatchQueue queue = { .entries = entries, .count = count, .next = 0 };
+#ifdef _WIN32
+    batch_worker(&queue);                                                  // No pthreads, convert serially
+#else
+    pthread_mutex_init(&queue.lock, NULL);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = count - cached;
+    if (workers > cpus) workers = (int)cpus;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+
+    pthread_t threads[MAX_WORKERS];
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &queue) == 0) started++;
+    }
+    batch_worker(&queue);                                                  // Main thread helps too
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+#endif
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].failed) {
+            free(entries);
+            return 1;                                                      // Errors were already reported
+        }
+    }
+
+    // Assemble header from cached array definitions into temporary file
+    char temp_file[1024];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", output_file);
+    FILE* outfile = fopen(temp_file, "w");
+    if (!outfile) {
+        fprintf(stderr, "Error: Cannot create output file '%s'\n", temp_file);
+        free(entries);
+        return 1;
+    }
+
+    char guard_source[256], header_guard[512];
+    strncpy(guard_source, output_file, sizeof(guard_source) - 1);
+    guard_source[sizeof(guard_source) - 1] = '\0';
+    generate_header_guard(basename(guard_source), header_guard);
+
+    fprintf(outfile, "#ifndef %s\n", header_guard);
+    fprintf(outfile, "#define %s\n\n", header_guard);
+    fprintf(outfile, "#include <stdint.h>\n\n");
+    for (int i = 0; i < count; i++) {
+        char name_source[1024];
+        strncpy(name_source, entries[i].input_file, sizeof(name_source) - 1);
+        name_source[sizeof(name_source) - 1] = '\0';
+        fprintf(outfile, "// Generated from %s\n", basename(name_source));
+
+        FILE* block = fopen(entries[i].cache_file, "r");
+        char buffer[65536];
+        size_t bytes_read;
+        while (block && (bytes_read = fread(buffer, 1, sizeof(buffer), block)) > 0) {
+            fwrite(buffer, 1, bytes_read, outfile);                        // Copy cached array definition
+        }
+        if (block) fclose(block);
+    }
+    fprintf(outfile, "#endif // %s\n", header_guard);
+    fclose(outfile);
+
+    // Replace output only when content changed, so unchanged header doesn't trigger recompilation
+    int unchanged = files_equal(temp_file, output_file);
+    if (unchanged) {
+        remove(temp_file);
+    } else {
+        remove(output_file);                                               // Windows rename() doesn't overwrite
+        if (rename(temp_file, output_file) != 0) {
+            fprintf(stderr, "Error: Cannot write output file '%s'\n", output_file);
+            remove(temp_file);
+            free(entries);
+            return 1;
+        }
+    }
+
+    printf("%d inputs: %d cached, %d converted, '%s' %s\n", count, cached, count - cached, output_file,
+           unchanged ? "unchanged" : "updated");
+    free(entries);
+    return 0;
+}
+
 // Main function - entry point of the program
 int main(int argc, char* argv[]) {
+    // Options valid in both modes
+    if (argc > 1 && strcmp(argv[1], "-f") == 0) {
+        feather_edges = 1;
+        argv[1] = argv[0];                                                 // Drop option, program name stays first
+        argc--;
+        argv++;
+    }
+
+    // Batch mode - cache directory, output header and list of inputs
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 5) {
+            usage(argv[0]);                                                // Display usage if insufficient arguments
+            return 1;
+        }
+        return run_batch(argv[2], argv[3], &argv[4], argc - 4);
+    }
+
     // Check command line arguments - need at least input and output filenames
     if (argc < 3 || argc > 4) {
         usage(argv[0]);                                                    // Display usage if insufficient arguments
@@ -286,71 +682,7 @@ int main(int argc, char* argv[]) {
         fprintf(outfile, "#include <stdint.h>\n\n");                       // Include for uint32_t type
     }
 
-    // Write array definition
-    fprintf(outfile, "// Contains %d pixels in ARGB format (0xAARRGGBB)\n\n", num_pixels);
-    fprintf(outfile, "static uint32_t %s[%d] = {\n", array_name, num_pixels);  // Array declaration
-    
-    // Skip P3 header if present before processing data
-    skip_p3_header_if_present(infile);
-    
-    // Process RGB values and convert to ARGB format
-    int pixel_count = 0;                                                   // Counter for completed pixels
-    int value_count = 0;                                                   // Counter for individual RGB values
-    int r, g, b;                                                           // Storage for red, green, blue components
-    char line[32];                                                         // Buffer for reading each line
-    
-    // Read and process each line of RGB data
-    while (fgets(line, sizeof(line), infile) && pixel_count < num_pixels) {
-        // Skip empty lines and whitespace-only lines
-        char* trimmed = line;
-        while (isspace(*trimmed)) trimmed++;
-        if (*trimmed == '\0') continue;
-        
-        int value;                                                         // Current RGB component value
-        if (sscanf(trimmed, "%d", &value) != 1) {                          // Parse integer from line
-            printf("Warning: Invalid RGB value '%s', skipping\n", trimmed);
-            continue;                                                      // Skip invalid lines
-        }
-        
-        // Validate RGB value range (0-255)
-        if (value > 255 || value < 0) {
-            printf("Warning: RGB value '%d' out of range (0-255)\n", value);
-        }
-        
-        // Clamp value to valid range
-        if (value > 255) value = 255;
-        if (value < 0) value = 0;
-        
-        // Assign value to appropriate RGB component based on position
-        switch (value_count % 3) {
-            case 0: r = value; break;                                      // First value is red
-            case 1: g = value; break;                                      // Second value is green
-            case 2:                                                        // Third value is blue - complete pixel
-                b = value;
-                // Calculate ARGB value: Alpha=0xFF (opaque), then R, G, B
-                uint32_t argb_val = 0xFF000000 | (r << 16) | (g << 8) | b;
-                
-                // Write pixel to output file with proper formatting
-                if (pixel_count == num_pixels - 1) {
-                    // Last element - no trailing comma
-                    fprintf(outfile, "    0x%08X  // px%d: RGB(%d,%d,%d)\n", 
-                            argb_val, pixel_count, r, g, b);
-                } else {
-                    // Regular element - with trailing comma
-                    fprintf(outfile, "    0x%08X, // px%d: RGB(%d,%d,%d)\n", 
-                            argb_val, pixel_count, r, g, b);
-                }
-                
-                pixel_count++;                                            // Increment completed pixel counter
-                break;
-        }
-        
-        value_count++;                                                    // Increment total value counter
-    }
-    
-    // Write C header file footer section
-    fprintf(outfile, "};\n\n");                                           // Close array definition
-    fprintf(outfile, "#define %s_SIZE %d\n\n", array_name, num_pixels);   // Define array size macro
+    write_array(infile, outfile, array_name, num_pixels);              // Convert pixels and write array definition
     
     // Always write the #endif at the end (whether new file or appending)
     fprintf(outfile, "#endif // %s\n", header_guard);                     // Header guard end